@@ -1,18 +1,55 @@
 // Bank Account Simulator — Single-file starter (C++17)
 // Features:
-//  - Create accounts with PIN (hashed; not cryptographically secure)
-//  - Multiple accounts stored in-memory (std::vector)
-//  - Deposit, withdraw, check balance
-//  - Simple login by account ID + PIN
-//  - Money stored as cents (integer) to avoid floating-point errors
+//  - Create accounts with PIN (PBKDF2-HMAC-SHA256, cost via BANK_PIN_COST)
+//  - Accounts stored in memory in a chunked arena (ChunkedArena), so
+//    Account* stays valid as the bank grows
+//  - Deposit, withdraw, transfer (atomic, deadlock-free), check balance
+//  - Login by account ID + PIN, then cached session tokens
+//  - Batched operations (applyBatch) and bulk account creation
+//  - Owner-name search (exact and prefix) over interned owner names
+//  - Cursor-paginated account listing by ID or balance
+//  - Money stored as cents (integer) to avoid floating-point errors;
+//    Money<Currency> with compile-time scale/symbol, checked arithmetic and
+//    batched FX conversion (fxConvert, Bank::balancesIn)
+//  - O(1) account lookup by ID (dense index, hash fallback for outliers)
+//  - ColumnarBank: structure-of-arrays backend for bulk balance scans/reports
+//  - SIMD (AVX2/NEON, runtime-selected) report kernels over the balance column
+//  - Persistence to accounts.tsv (buffered streaming save/load)
+//  - Binary snapshot accounts.snap, mmap'ed at startup and copied on touch
+//  - Write-ahead log accounts.wal with group commit (BANK_WAL_SYNC=none|group|always)
+//  - Background (fork/copy-on-write) checkpoints that truncate the WAL
+//  - Thread-safe Bank: striped locks, or lock-free atomic balances
+//    (BANK_BALANCE_MODE=atomic)
+//  - ShardedBank: accounts split by ID range across independent Banks, each
+//    with its own store, index and WAL; cross-shard transfers as logged
+//    halves, refunded if refused and repaired on recovery
+//  - Work-stealing request engine with per-account affinity; the menu is one
+//    of its clients (BANK_WORKERS=N, default one per core)
+//  - epoll TCP server with a pipelined, length-prefixed binary protocol,
+//    plus a load generator (requests/sec and latency percentiles)
+//  - Scripted batch mode (--script) for reproducible replays
+//  - Parallel interest/fee accrual (Bank::accrue, script ACCRUE): chunked
+//    over stripe groups, one WAL record per chunk
+//  - Per-operation latency histograms and decline counters (menu option 5,
+//    or GET /metrics on the server port; BANK_STATS=0 turns them off)
+//  - Per-account statement history (last N or a date range) in a shared
+//    ring of segments (BANK_HISTORY=entries kept, 0 = off)
+//  - Snapshot-isolated reporting reads (Bank::readView): a pinned,
+//    point-in-time view of every balance, scanned while updates carry on
 //
 // Build (Linux/Mac):
-//   g++ -std=gnu++17 -O2 -Wall -Wextra -pedantic -o bank main.cpp
+//   g++ -std=gnu++17 -O2 -Wall -Wextra -pedantic -pthread -o bank main.cpp
 // Run:
 //   ./bank
+//   ./bank --bench [N] [--json FILE] [--filter GROUP]  (N = accounts to load)
+//   ./bank --bench-compare BASE.jsonl NEW.jsonl [PCT]  (regression check)
+//   ./bank --footprint [N] (memory per account, default N = 10M)
+//   ./bank --serve [port]  (binary-protocol TCP server, default port 7070)
+//   ./bank --loadgen [host:]port [connections] [seconds] [pipeline]
+//   ./bank --script [file|-] [--memory]  (one command per line, e.g. DEP 1001 12.34)
 //
 // NOTE: This single-file version is great for learning. Later, we can split
-// into Account.hpp/Bank.hpp and add file persistence (save/load).
+// into Account.hpp/Bank.hpp.
 
 
 using namespace std;
@@ -25,9 +62,4205 @@ using namespace std;
 #include <random>
 #include <algorithm>
 #include <fstream>
+#include <unordered_map>
+#include <chrono>
+#include <ctime>
+#include <memory>
+#include <new>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <string_view>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <atomic>
+#include <array>
+#include <deque>
+#include <iterator>
+#include <sys/wait.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <signal.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 // ---------------- Money helpers ----------------
+// Error codes for tryParseAmountCents (no exceptions on the batch path).
+enum class AmountError { None, Empty, Invalid, OutOfRange };
+
+static const char* amountErrorMessage(AmountError e) {
+    switch (e) {
+        case AmountError::None: return "ok";
+        case AmountError::Empty: return "empty amount";
+        case AmountError::Invalid: return "not a number";
+        case AmountError::OutOfRange: return "amount out of range";
+    }
+    return "?";
+}
+
+static constexpr long long pow10ll(int n) { long long v = 1; while (n-- > 0) v *= 10; return v; }
+
+// Non-throwing, allocation-free amount parser for bulk ingestion, into
+// minor units with Decimals digits after the point.
+// Accepts [+-]digits[.digits] with optional leading/trailing whitespace, e.g.
+// "123", "123.45", ".99", "-0.50"; digits past the last decimal are
+// truncated. The sign applies to the whole amount ("-1.50" -> -150).
+template <int Decimals>
+static AmountError tryParseAmountMinor(string_view s, long long &minor) noexcept {
+    constexpr long long kScale = pow10ll(Decimals);
+    const char *p = s.data(), *end = p + s.size();
+    while (p < end && isspace((unsigned char)*p)) ++p;
+    while (end > p && isspace((unsigned char)end[-1])) --end;
+    if (p == end) return AmountError::Empty;
+    bool neg = *p == '-';
+    if (*p == '-' || *p == '+') ++p;
+
+    long long whole = 0;
+    bool anyDigit = false;
+    if (p < end && *p >= '0' && *p <= '9') {
+        auto r = from_chars(p, end, whole);
+        if (r.ec == errc::result_out_of_range) return AmountError::OutOfRange;
+        p = r.ptr; anyDigit = true;
+    }
+    long long frac = 0;
+    if (p < end && *p == '.') {
+        ++p;
+        int n = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p, ++n)
+            if (n < Decimals) frac = frac * 10 + (*p - '0');
+        for (int k = n; k < Decimals; ++k) frac *= 10;
+        anyDigit |= n > 0;
+    }
+    if (p != end || !anyDigit) return AmountError::Invalid;
+    if (whole > (LLONG_MAX - frac) / kScale) return AmountError::OutOfRange;
+    long long v = whole * kScale + frac;
+    minor = neg ? -v : v;
+    return AmountError::None;
+}
+
+static AmountError tryParseAmountCents(string_view s, long long &cents) noexcept { return tryParseAmountMinor<2>(s, cents); }
+
+// Throwing wrapper used by the interactive prompts.
 static long long parseAmountCents(const string &s) {
+    long long cents = 0;
+    AmountError e = tryParseAmountCents(s, cents);
+    if (e != AmountError::None) throw invalid_argument(amountErrorMessage(e));
+    return cents;
+}
+
+// Currencies are tag types: ISO code, symbol and decimal places are all
+// constexpr, so Money<C> arithmetic, parsing and formatting compile down to
+// constant scales with nothing looked up at run time. The bank's books
+// (balances, WAL, snapshots) are kept in BookCurrency.
+struct USD { static constexpr const char *kCode = "USD", *kSymbol = "$"; static constexpr int kDecimals = 2; };
+struct EUR { static constexpr const char *kCode = "EUR", *kSymbol = "\u20ac"; static constexpr int kDecimals = 2; };
+struct GBP { static constexpr const char *kCode = "GBP", *kSymbol = "\u00a3"; static constexpr int kDecimals = 2; };
+struct JPY { static constexpr const char *kCode = "JPY", *kSymbol = "\u00a5"; static constexpr int kDecimals = 0; };
+struct KWD { static constexpr const char *kCode = "KWD", *kSymbol = "KD "; static constexpr int kDecimals = 3; };
+using BookCurrency = USD;
+
+// Longest output: 20 digits, a point, up to 3 decimals, sign and a symbol
+// of up to 4 bytes; "-$92233720368547758.08" is 22 chars.
+static constexpr size_t kMoneyTextMax = 32, kCentsTextMax = kMoneyTextMax;
+
+// Writes minor units of C as "$12.34" / "-$0.05" / "\u00a5500" into buf
+// (>= kMoneyTextMax bytes) and returns the length. No allocation, no
+// iostream/locale.
+template <class C>
+static size_t formatMoneyTo(char *buf, long long minor) noexcept {
+    constexpr unsigned long long kScale = (unsigned long long)pow10ll(C::kDecimals);
+    constexpr string_view kSymbol = C::kSymbol;
+    char *p = buf;
+    unsigned long long m = (unsigned long long)minor;
+    if (minor < 0) { *p++ = '-'; m = 0ULL - m; }
+    memcpy(p, kSymbol.data(), kSymbol.size()); p += kSymbol.size();
+    p = to_chars(p, buf + kMoneyTextMax, m / kScale).ptr;
+    if constexpr (C::kDecimals > 0) {
+        unsigned long long rem = m % kScale;
+        *p++ = '.';
+        for (int k = C::kDecimals; k-- > 0; rem /= 10) p[k] = char('0' + rem % 10);
+        p += C::kDecimals;
+    }
+    return (size_t)(p - buf);
+}
+
+static size_t formatCentsTo(char *buf, long long cents) noexcept { return formatMoneyTo<USD>(buf, cents); }
+
+static void appendCents(string &out, long long cents) {
+    char buf[kCentsTextMax];
+    out.append(buf, formatCentsTo(buf, cents));
+}
+
+// Stack-held formatted amount for `cout << centsText(x)` without a temporary string.
+struct CentsText { char buf[kCentsTextMax]; size_t len; };
+static CentsText centsText(long long cents) { CentsText t; t.len = formatCentsTo(t.buf, cents); return t; }
+static ostream& operator<<(ostream &os, const CentsText &t) { return os.write(t.buf, (streamsize)t.len); }
+
+static string formatCents(long long cents) {
+    char buf[kCentsTextMax];
+    return string(buf, formatCentsTo(buf, cents));
+}
+
+// An amount in currency C, held as a count of C's minor units. Mixing
+// currencies doesn't compile; convert with an FxRate. The operators throw
+// overflow_error instead of wrapping; tryAdd/trySub report it instead.
+template <class C>
+class Money {
+    long long minor_ = 0;
+public:
+    using Currency = C;
+    static constexpr long long kScale = pow10ll(C::kDecimals);
+
+    constexpr Money() = default;
+    static constexpr Money fromMinor(long long minor) { Money m; m.minor_ = minor; return m; }
+    constexpr long long minor() const { return minor_; }
+
+    static bool tryAdd(Money a, Money b, Money &out) noexcept { return !__builtin_add_overflow(a.minor_, b.minor_, &out.minor_); }
+    static bool trySub(Money a, Money b, Money &out) noexcept { return !__builtin_sub_overflow(a.minor_, b.minor_, &out.minor_); }
+    Money operator+(Money o) const { Money r; if (!tryAdd(*this, o, r)) throw overflow_error("amount overflow"); return r; }
+    Money operator-(Money o) const { Money r; if (!trySub(*this, o, r)) throw overflow_error("amount overflow"); return r; }
+    Money& operator+=(Money o) { return *this = *this + o; }
+    Money& operator-=(Money o) { return *this = *this - o; }
+    constexpr bool operator==(Money o) const { return minor_ == o.minor_; }
+    constexpr bool operator!=(Money o) const { return minor_ != o.minor_; }
+    constexpr bool operator<(Money o) const { return minor_ < o.minor_; }
+    constexpr bool operator<=(Money o) const { return minor_ <= o.minor_; }
+    constexpr bool operator>(Money o) const { return minor_ > o.minor_; }
+    constexpr bool operator>=(Money o) const { return minor_ >= o.minor_; }
+
+    static AmountError tryParse(string_view s, Money &out) noexcept { return tryParseAmountMinor<C::kDecimals>(s, out.minor_); }
+    size_t formatTo(char *buf) const noexcept { return formatMoneyTo<C>(buf, minor_); }
+    string str() const { char buf[kMoneyTextMax]; return string(buf, formatTo(buf)); }
+};
+using BookMoney = Money<BookCurrency>;
+
+// Units of To per unit of From, fixed point with 8 decimals: 1 USD = 0.9215
+// EUR is FxRate<USD, EUR>{92150000}. Conversion is exact integer math
+// (128-bit intermediate), rounded half away from zero, so every run and
+// every platform produces the same minor units.
+template <class From, class To>
+struct FxRate {
+    static constexpr int kDecimals = 8;
+    long long e8;
+
+    static AmountError tryParse(string_view s, FxRate &r) noexcept {
+        long long v = 0;
+        AmountError e = tryParseAmountMinor<kDecimals>(s, v);
+        if (e == AmountError::None && v <= 0) e = AmountError::Invalid;
+        if (e == AmountError::None) r.e8 = v;
+        return e;
+    }
+    FxRate<To, From> inverse() const { // rounded to 8 decimals, so not an exact round trip
+        __extension__ typedef __int128 wide;
+        const wide one = (wide)pow10ll(kDecimals) * pow10ll(kDecimals);
+        return {(long long)((one + e8 / 2) / e8)};
+    }
+
+    // False (out untouched) if the result doesn't fit.
+    bool tryConvert(Money<From> in, Money<To> &out) const noexcept {
+        constexpr long long kDen64 = pow10ll(kDecimals) * Money<From>::kScale; // constant: division by it is a multiply
+        long long n64;
+        if (!__builtin_mul_overflow(in.minor(), e8, &n64) && !__builtin_mul_overflow(n64, Money<To>::kScale, &n64)) {
+            long long q = n64 / kDen64, r = n64 % kDen64;
+            if (2 * llabs(r) >= kDen64) q += n64 < 0 ? -1 : 1;
+            out = Money<To>::fromMinor(q);
+            return true;
+        }
+        __extension__ typedef __int128 wide; // large amounts: same math in 128 bits
+        constexpr wide kDen = kDen64;
+        wide num;
+        if (__builtin_mul_overflow((wide)in.minor(), (wide)e8, &num) || __builtin_mul_overflow(num, (wide)Money<To>::kScale, &num)) return false;
+        wide q = num / kDen, r = num % kDen;
+        if (2 * (r < 0 ? -r : r) >= kDen) q += num < 0 ? -1 : 1;
+        if (q > LLONG_MAX || q < LLONG_MIN) return false;
+        out = Money<To>::fromMinor((long long)q);
+        return true;
+    }
+};
+
+// Batched conversion at one rate (a loop the compiler can keep in
+// registers: the scales are constants). Returns how many amounts were
+// converted before the first that would overflow; n if all were.
+template <class From, class To>
+static size_t fxConvert(const Money<From> *in, size_t n, FxRate<From, To> rate, Money<To> *out) noexcept {
+    for (size_t i = 0; i < n; ++i) if (!rate.tryConvert(in[i], out[i])) return i;
+    return n;
+}
+
+// Buffered text output for listings: callers append to buffer() and the
+// sink hands it to the stream in flushAt-sized writes.
+class TextSink {
+    ostream &os_;
+    string buf_;
+    size_t flushAt_;
+public:
+    explicit TextSink(ostream &os, size_t flushAt = 64 * 1024) : os_(os), flushAt_(flushAt) { buf_.reserve(flushAt + 256); }
+    TextSink(const TextSink &) = delete;
+    TextSink& operator=(const TextSink &) = delete;
+    ~TextSink() { flush(); }
+    string& buffer() { return buf_; }
+    void maybeFlush() { if (buf_.size() >= flushAt_) flush(); }
+    void flush() { if (!buf_.empty()) { os_.write(buf_.data(), (streamsize)buf_.size()); buf_.clear(); } }
+};
+
+// ---------------- PIN hashing ----------------
+// PBKDF2-HMAC-SHA256 (RFC 8018) over the PIN with the account's 8-byte salt
+// and 2^cost iterations, truncated to the 64 bits the storage formats hold.
+// Cost 0 is the old std::hash scheme: it's kept only to verify accounts
+// saved before the KDF, and a successful login rehashes them. Short PINs
+// stay guessable offline whatever the cost; the KDF makes each guess (and
+// each leaked-file attempt) expensive, it can't add entropy.
+static void sha256Block(uint32_t s[8], const unsigned char *p) {
+    static const uint32_t K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    auto ror = [](uint32_t x, int n) { return x >> n | x << (32 - n); };
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    for (int i = 16; i < 64; ++i)
+        w[i] = w[i - 16] + (ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ w[i - 15] >> 3) + w[i - 7]
+             + (ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ w[i - 2] >> 10);
+    uint32_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t t1 = h + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1; d = c; c = b; b = a; a = t1 + t2;
+    }
+    s[0] += a; s[1] += b; s[2] += c; s[3] += d; s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+}
+
+struct Sha256 {
+    uint32_t s[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    unsigned char buf[64];
+    size_t used = 0;
+    uint64_t total = 0;
+
+    void update(const void *data, size_t n) {
+        const unsigned char *p = (const unsigned char *)data;
+        total += n;
+        if (used) {
+            size_t k = min(n, 64 - used);
+            memcpy(buf + used, p, k); used += k; p += k; n -= k;
+            if (used < 64) return;
+            sha256Block(s, buf); used = 0;
+        }
+        for (; n >= 64; p += 64, n -= 64) sha256Block(s, p);
+        memcpy(buf, p, n); used = n;
+    }
+    void final(unsigned char out[32]) {
+        uint64_t bits = total * 8;
+        unsigned char pad = 0x80;
+        update(&pad, 1);
+        pad = 0;
+        while (used != 56) update(&pad, 1);
+        for (int i = 7; i >= 0; --i) buf[56 + (7 - i)] = (unsigned char)(bits >> (8 * i));
+        sha256Block(s, buf);
+        for (int i = 0; i < 8; ++i) for (int k = 0; k < 4; ++k) out[4 * i + k] = (unsigned char)(s[i] >> (24 - 8 * k));
+    }
+};
+
+// PBKDF2 first block: U1 = HMAC(pin, salt || 1), Uk = HMAC(pin, Uk-1), out = xor of all Uk.
+// The ipad/opad states are computed once, so each iteration is two compressions.
+static void pbkdf2Sha256(string_view pass, const void *salt, size_t saltLen, uint32_t iterations, unsigned char out[32]) {
+    unsigned char key[64] = {}, pad[64];
+    if (pass.size() > 64) { Sha256 k; k.update(pass.data(), pass.size()); k.final(key); }
+    else memcpy(key, pass.data(), pass.size());
+    Sha256 inner, outer;
+    for (int i = 0; i < 64; ++i) pad[i] = key[i] ^ 0x36;
+    inner.update(pad, 64);
+    for (int i = 0; i < 64; ++i) pad[i] = key[i] ^ 0x5c;
+    outer.update(pad, 64);
+    auto hmac = [&](const void *msg, size_t n, const void *msg2, size_t n2, unsigned char mac[32]) {
+        Sha256 in = inner, ou = outer;
+        in.update(msg, n); if (n2) in.update(msg2, n2);
+        in.final(mac);
+        ou.update(mac, 32); ou.final(mac);
+    };
+    const unsigned char one[4] = {0, 0, 0, 1};
+    unsigned char u[32];
+    hmac(salt, saltLen, one, 4, u);
+    memcpy(out, u, 32);
+    for (uint32_t it = 1; it < iterations; ++it) {
+        hmac(u, 32, nullptr, 0, u);
+        for (int i = 0; i < 32; ++i) out[i] ^= u[i];
+    }
+}
+
+// Cost (log2 PBKDF2 iterations) for new hashes. Each account stores the
+// cost its hash was made with, so changing this (BANK_PIN_COST) never
+// locks anyone out.
+static constexpr unsigned kDefaultPinCost = 12, kMaxPinCost = 24;
+static atomic<unsigned> g_pinCost{kDefaultPinCost};
+
+static size_t hashPin(const string &pin, size_t salt, unsigned cost) {
+    if (cost == 0) return std::hash<string>{}(pin + to_string(salt)) ^ (salt << 1); // legacy, verify only
+    unsigned char out[32];
+    pbkdf2Sha256(pin, &salt, sizeof salt, uint32_t(1) << min(cost, kMaxPinCost), out);
+    size_t h; memcpy(&h, out, sizeof h);
+    return h;
+}
+
+// Salts come from a per-thread pool refilled from the OS CSPRNG, 256 bytes
+// (one getentropy call) at a time, instead of a random_device + mt19937_64
+// per account.
+static size_t makeSalt() {
+    static constexpr size_t kPool = 256 / sizeof(size_t);
+    thread_local size_t pool[kPool];
+    thread_local size_t left = 0;
+    if (left == 0) {
+        if (::getentropy(pool, sizeof pool) != 0) { random_device rd; for (auto &v : pool) v = (size_t)rd() << 32 ^ rd(); }
+        left = kPool;
+    }
+    return pool[--left];
+}
+
+static bool validPin(const string &pin) {
+    return pin.size() >= 4 && pin.size() <= 12 && all_of(pin.begin(), pin.end(), ::isdigit);
+}
+
+// Longest owner name accepted: WAL Create records store a u16 length.
+static constexpr size_t kMaxOwnerBytes = 65535;
+
+// ---------------- Operation status ----------------
+// Outcome of a balance/PIN operation. The try* methods return it (noexcept)
+// so routine declines cost a branch, not an unwind; the throwing methods
+// are thin wrappers that turn it into the historical exceptions.
+enum class OpStatus { Ok, NoSuchAccount, InvalidAmount, InsufficientFunds, SameAccount, InvalidPin, BalanceLimit };
+
+// Largest balance a credit may produce. Half of LLONG_MAX, so undoing a
+// debit (or a shard's unconditional credit, see ShardedBank) can never wrap.
+static constexpr long long kMaxBalanceCents = LLONG_MAX / 2;
+
+static const char* opStatusMessage(OpStatus s) {
+    switch (s) {
+        case OpStatus::Ok: return "ok";
+        case OpStatus::NoSuchAccount: return "No such account";
+        case OpStatus::InvalidAmount: return "Amount must be positive";
+        case OpStatus::InsufficientFunds: return "Insufficient funds";
+        case OpStatus::SameAccount: return "Cannot transfer to the same account";
+        case OpStatus::InvalidPin: return "PIN must be 4-12 digits";
+        case OpStatus::BalanceLimit: return "Balance limit exceeded";
+    }
+    return "?";
+}
+
+// amountMsg names the operation for InvalidAmount ("Deposit must be positive").
+[[noreturn]] static void throwOpStatus(OpStatus s, const char *amountMsg = nullptr) {
+    if (s == OpStatus::InsufficientFunds) throw runtime_error(opStatusMessage(s));
+    if (s == OpStatus::BalanceLimit) throw overflow_error(opStatusMessage(s));
+    throw invalid_argument(s == OpStatus::InvalidAmount && amountMsg ? amountMsg : opStatusMessage(s));
+}
+
+// ---------------- Chunked arena ----------------
+// Append-only storage in fixed-size chunks (2^ChunkBits elements each).
+// Growing allocates a new chunk and never moves existing elements, so
+// pointers/references handed out (e.g. by Bank::login) stay valid for the
+// lifetime of the arena. Indexing is a shift + mask, so it's as cheap as a
+// vector lookup.
+//
+// Single writer, many readers: the chunk directory is a fixed array that
+// never reallocates, and emplace_back publishes the new size with release
+// order after the element is built, so readers may index any i < size()
+// without a lock. emplace_back itself (and clear) must be serialized by the
+// caller.
+template <class T, unsigned ChunkBits = 12>
+class ChunkedArena {
+    static constexpr size_t kChunk = size_t(1) << ChunkBits;
+    static constexpr size_t kMask = kChunk - 1;
+    static constexpr size_t kMaxChunks = size_t(1) << 15;
+    struct Chunk { alignas(T) unsigned char raw[sizeof(T) * kChunk]; };
+    unique_ptr<atomic<Chunk*>[]> dir_{new atomic<Chunk*>[kMaxChunks]()};
+    atomic<size_t> size_{0};
+
+    T* slot(size_t i) const {
+        return reinterpret_cast<T*>(dir_[i >> ChunkBits].load(memory_order_acquire)->raw) + (i & kMask);
+    }
+public:
+    ChunkedArena() = default;
+    ChunkedArena(const ChunkedArena &) = delete;
+    ChunkedArena& operator=(const ChunkedArena &) = delete;
+    ~ChunkedArena() { clear(); }
+
+    template <class... Args> T& emplace_back(Args&&... args) {
+        size_t n = size_.load(memory_order_relaxed);
+        if ((n & kMask) == 0) {
+            if ((n >> ChunkBits) >= kMaxChunks) throw length_error("arena full");
+            if (!dir_[n >> ChunkBits].load(memory_order_relaxed))
+                dir_[n >> ChunkBits].store(new Chunk, memory_order_release);
+        }
+        T* p = new (slot(n)) T(std::forward<Args>(args)...);
+        size_.store(n + 1, memory_order_release);
+        return *p;
+    }
+
+    T& operator[](size_t i) { return *slot(i); }
+    const T& operator[](size_t i) const { return *slot(i); }
+    size_t size() const { return size_.load(memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+
+    void clear() {
+        size_t n = size_.load(memory_order_relaxed);
+        for (size_t i = 0; i < n; ++i) slot(i)->~T();
+        for (size_t c = 0; c < kMaxChunks && dir_[c].load(memory_order_relaxed); ++c) {
+            delete dir_[c].load(memory_order_relaxed);
+            dir_[c].store(nullptr, memory_order_relaxed);
+        }
+        size_.store(0, memory_order_release);
+    }
+
+    template <class Ref, class Owner> class Iter {
+        Owner *a_; size_t i_;
+    public:
+        Iter(Owner *a, size_t i) : a_(a), i_(i) {}
+        Ref operator*() const { return (*a_)[i_]; }
+        Iter& operator++() { ++i_; return *this; }
+        bool operator!=(const Iter &o) const { return i_ != o.i_; }
+    };
+    using iterator = Iter<T&, ChunkedArena>;
+    using const_iterator = Iter<const T&, const ChunkedArena>;
+    iterator begin() { return {this, 0}; }
+    iterator end() { return {this, size()}; }
+    const_iterator begin() const { return {this, 0}; }
+    const_iterator end() const { return {this, size()}; }
+};
+
+// ---------------- Owner names ----------------
+// Process-wide intern table: each distinct owner name is stored once, in
+// 64 KB blocks that never move, and an Account keeps only its 4-byte ID.
+// get() is lock-free (the ID -> name table is a ChunkedArena, published
+// the same way); intern() takes a mutex. Append-only: a name is never
+// freed, which is fine for the handful of distinct names per account.
+class OwnerNames {
+    static constexpr size_t kBlock = 64 * 1024;
+    mutable mutex mu_;
+    ChunkedArena<string_view> names_;
+    unordered_map<string_view, uint32_t> ids_;
+    vector<unique_ptr<char[]>> blocks_; // blocks_.back() is being filled
+    size_t used_ = kBlock, bytes_ = 0;
+public:
+    uint32_t intern(string_view name) {
+        lock_guard<mutex> lk(mu_);
+        auto it = ids_.find(name);
+        if (it != ids_.end()) return it->second;
+        char *p;
+        if (name.size() > kBlock / 4) { // own block, inserted behind the one being filled
+            p = blocks_.insert(blocks_.empty() ? blocks_.end() : blocks_.end() - 1, unique_ptr<char[]>(new char[name.size()]))->get();
+            bytes_ += name.size();
+        } else {
+            if (kBlock - used_ < name.size()) { blocks_.emplace_back(new char[kBlock]); used_ = 0; bytes_ += kBlock; }
+            p = blocks_.back().get() + used_;
+            used_ += name.size();
+        }
+        if (!name.empty()) memcpy(p, name.data(), name.size());
+        uint32_t id = (uint32_t)names_.size();
+        string_view stored(p, name.size());
+        names_.emplace_back(stored);
+        ids_.emplace(stored, id);
+        return id;
+    }
+
+    string_view get(uint32_t id) const { return names_[id]; }
+    size_t size() const { return names_.size(); }
+    // Approximate footprint: name blocks + ID table + hash index.
+    size_t bytes() const {
+        lock_guard<mutex> lk(mu_);
+        return bytes_ + names_.size() * sizeof(string_view)
+             + ids_.size() * (sizeof(string_view) + sizeof(uint32_t) + 2 * sizeof(void *)) + ids_.bucket_count() * sizeof(void *);
+    }
+};
+
+static OwnerNames& ownerNames() { static OwnerNames t; return t; }
+
+// ---------------- Account class ----------------
+// balanceCents_ is a std::atomic so Bank's lock-free mode can CAS
+// it; Account's own methods stay plain read-modify-write (relaxed), i.e.
+// single-threaded semantics unless called through Bank.
+class Account {
+    int id_;
+    uint32_t owner_;                     // OwnerNames ID
+    atomic<long long> balanceCents_{0};  // store as cents
+    size_t salt_ = 0;
+    size_t pinHash_ = 0;
+    uint8_t pinCost_ = 0;                // hashPin cost pinHash_ was made with
+    atomic<uint32_t> epoch_{0};          // Bank read-view epoch of the last balance write (fits the padding)
+public:
+    friend class Bank;
+
+    Account(const Account &o)
+        : id_(o.id_), owner_(o.owner_), balanceCents_(o.balanceCents()), salt_(o.salt_), pinHash_(o.pinHash_), pinCost_(o.pinCost_),
+          epoch_(o.epoch_.load(memory_order_relaxed)) {}
+
+    Account(int id, string_view owner, const string &pin)
+        : id_(id), owner_(ownerNames().intern(owner)), salt_(makeSalt()) {
+        setPin(pin);
+    }
+
+    // Restore a persisted account as-is (no PIN re-hash, no new salt).
+    // ownerId comes from ownerNames().intern().
+    Account(int id, uint32_t ownerId, long long balanceCents, size_t salt, size_t pinHash, unsigned pinCost)
+        : id_(id), owner_(ownerId), balanceCents_(balanceCents), salt_(salt), pinHash_(pinHash), pinCost_((uint8_t)pinCost) {}
+
+    int id() const { return id_; }
+    string_view owner() const { return ownerNames().get(owner_); }
+    long long balanceCents() const { return balanceCents_.load(memory_order_relaxed); }
+
+    unsigned pinCost() const { return pinCost_; }
+    bool verifyPin(const string &pin) const { return hashPin(pin, salt_, pinCost_) == pinHash_; }
+
+    OpStatus trySetPin(const string &pin) noexcept {
+        if (!validPin(pin)) return OpStatus::InvalidPin;
+        unsigned cost = g_pinCost.load(memory_order_relaxed);
+        pinHash_ = hashPin(pin, salt_, cost);
+        pinCost_ = (uint8_t)cost;
+        return OpStatus::Ok;
+    }
+
+    OpStatus tryDeposit(long long cents) noexcept {
+        if (cents <= 0) return OpStatus::InvalidAmount;
+        long long bal;
+        if (__builtin_add_overflow(balanceCents(), cents, &bal) || bal > kMaxBalanceCents) return OpStatus::BalanceLimit;
+        balanceCents_.store(bal, memory_order_relaxed);
+        return OpStatus::Ok;
+    }
+
+    OpStatus tryWithdraw(long long cents) noexcept {
+        if (cents <= 0) return OpStatus::InvalidAmount;
+        if (cents > balanceCents()) return OpStatus::InsufficientFunds;
+        balanceCents_.store(balanceCents() - cents, memory_order_relaxed);
+        return OpStatus::Ok;
+    }
+
+    void setPin(const string &pin) { if (OpStatus s = trySetPin(pin); s != OpStatus::Ok) throwOpStatus(s); }
+    void deposit(long long cents) { if (OpStatus s = tryDeposit(cents); s != OpStatus::Ok) throwOpStatus(s, "Deposit must be positive"); }
+    void withdraw(long long cents) { if (OpStatus s = tryWithdraw(cents); s != OpStatus::Ok) throwOpStatus(s, "Withdrawal must be positive"); }
+};
+
+// ---------------- Account index ----------------
+// Maps account ID -> slot (position in Bank's storage). IDs are handed out
+// sequentially from 1001, so the common case is a flat array indexed by
+// id - kBase, split into 4K-entry pages that are allocated on first use; a
+// missing/closed account is just a -1 hole. IDs outside the paged range go
+// to a hash map instead. Slots, not pointers, are stored, so the index
+// survives storage reallocation.
+//
+// Like ChunkedArena: writers (insert/erase/clear) must be serialized by the
+// caller, but find() is safe concurrently with them. Dense lookups take no
+// lock; the hash map is guarded by sparseMu_ only once something is in it.
+class AccountIndex {
+    static constexpr int kBase = 1001;
+    static constexpr unsigned kPageBits = 12;
+    static constexpr size_t kPage = size_t(1) << kPageBits, kMaxPages = size_t(1) << 15;
+    struct Page { atomic<int> slot[kPage]; Page() { for (auto &s : slot) s.store(-1, memory_order_relaxed); } };
+    unique_ptr<atomic<Page*>[]> pages_{new atomic<Page*>[kMaxPages]()};
+    unordered_map<int, int> sparse_;
+    mutable mutex sparseMu_;
+    atomic<bool> hasSparse_{false};
+
+    static bool denseKey(int id, size_t &k) {
+        if (id < kBase) return false;
+        k = (size_t)(id - kBase);
+        return (k >> kPageBits) < kMaxPages;
+    }
+    Page* page(size_t k) {
+        atomic<Page*> &p = pages_[k >> kPageBits];
+        Page *pg = p.load(memory_order_relaxed);
+        if (!pg) { pg = new Page; p.store(pg, memory_order_release); }
+        return pg;
+    }
+public:
+    // True once any ID outside the dense range [kBase, ...) was inserted.
+    bool hasSparse() const { return hasSparse_.load(memory_order_acquire); }
+    static constexpr int npos = -1;
+
+    AccountIndex() = default;
+    AccountIndex(const AccountIndex &) = delete;
+    AccountIndex& operator=(const AccountIndex &) = delete;
+    ~AccountIndex() { clear(); }
+
+    void insert(int id, int slot) {
+        size_t k;
+        if (denseKey(id, k)) { page(k)->slot[k & (kPage - 1)].store(slot, memory_order_release); return; }
+        lock_guard<mutex> lk(sparseMu_);
+        sparse_[id] = slot;
+        hasSparse_.store(true, memory_order_release);
+    }
+
+    int find(int id) const {
+        size_t k;
+        if (denseKey(id, k)) {
+            const Page *pg = pages_[k >> kPageBits].load(memory_order_acquire);
+            return pg ? pg->slot[k & (kPage - 1)].load(memory_order_acquire) : npos;
+        }
+        if (!hasSparse()) return npos;
+        lock_guard<mutex> lk(sparseMu_);
+        auto it = sparse_.find(id);
+        return it == sparse_.end() ? npos : it->second;
+    }
+
+    void erase(int id) {
+        size_t k;
+        if (denseKey(id, k)) {
+            if (Page *pg = pages_[k >> kPageBits].load(memory_order_relaxed)) pg->slot[k & (kPage - 1)].store(npos, memory_order_release);
+            return;
+        }
+        lock_guard<mutex> lk(sparseMu_);
+        sparse_.erase(id);
+    }
+
+    // IDs [kBase, kBase + kDenseIds) are served from pages; the rest from sparse_.
+    static constexpr size_t kDenseIds = kPage * kMaxPages;
+
+    // Pre-allocates pages for n sequential IDs starting at first.
+    void reserve(size_t n, int first = kBase) {
+        size_t k0;
+        if (!denseKey(first, k0)) return;
+        for (size_t k = k0 & ~(kPage - 1); k < k0 + n && (k >> kPageBits) < kMaxPages; k += kPage) page(k);
+    }
+
+    void clear() {
+        for (size_t p = 0; p < kMaxPages; ++p) {
+            delete pages_[p].load(memory_order_relaxed);
+            pages_[p].store(nullptr, memory_order_relaxed);
+        }
+        lock_guard<mutex> lk(sparseMu_);
+        sparse_.clear();
+        hasSparse_.store(false, memory_order_release);
+    }
+};
+
+// ---------------- Owner index ----------------
+// Owner name -> account IDs, for exact and prefix search. One 8-byte entry
+// (name ID, account ID) per account, ordered by (name, account ID) in two
+// sorted runs: a large base and a small delta that takes single inserts
+// (O(kDelta) moves) and is merged into the base once it holds kDelta
+// entries (amortized O(n / kDelta)). Queries binary-search both runs, so
+// they're O(log n + matches). build()/insertMany() sort on integer name
+// ranks rather than strings. Not synchronized; Bank guards it with ownerMu_.
+struct OwnerMatch { int id; string_view owner; };
+
+class OwnerIndex {
+public:
+    struct Entry { uint32_t owner; int id; };
+private:
+    static constexpr size_t kDelta = 4096;
+    vector<Entry> base_, delta_;
+
+    static bool less(const Entry &a, const Entry &b) {
+        if (a.owner == b.owner) return a.id < b.id; // interned: same ID <=> same name
+        return ownerNames().get(a.owner) < ownerNames().get(b.owner);
+    }
+    // Ranks the distinct names once, then sorts on integer (rank, id) keys
+    // instead of comparing strings O(n log n) times.
+    static void sortByName(vector<Entry> &v) {
+        vector<uint32_t> names;
+        names.reserve(v.size());
+        for (const Entry &e : v) names.push_back(e.owner);
+        sort(names.begin(), names.end());
+        names.erase(unique(names.begin(), names.end()), names.end());
+        sort(names.begin(), names.end(), [](uint32_t a, uint32_t b) { return ownerNames().get(a) < ownerNames().get(b); });
+        unordered_map<uint32_t, uint32_t> rank;
+        rank.reserve(names.size());
+        for (uint32_t r = 0; r < names.size(); ++r) rank[names[r]] = r;
+        vector<uint64_t> keys(v.size());
+        for (size_t i = 0; i < v.size(); ++i) keys[i] = (uint64_t)rank[v[i].owner] << 32 | (uint32_t)v[i].id;
+        sort(keys.begin(), keys.end());
+        for (size_t i = 0; i < keys.size(); ++i) v[i] = Entry{names[keys[i] >> 32], (int)(uint32_t)keys[i]};
+    }
+    // Appends up to limit entries of run v whose name starts with p (or equals it).
+    static void scan(const vector<Entry> &v, string_view p, bool exact, size_t limit, vector<Entry> &out) {
+        auto it = lower_bound(v.begin(), v.end(), p, [](const Entry &e, string_view key) { return ownerNames().get(e.owner) < key; });
+        for (; it != v.end() && limit > 0; ++it, --limit) {
+            string_view name = ownerNames().get(it->owner);
+            if (exact ? name != p : name.substr(0, p.size()) != p) break;
+            out.push_back(*it);
+        }
+    }
+public:
+    void clear() { base_.clear(); delta_.clear(); }
+    size_t size() const { return base_.size() + delta_.size(); }
+
+    void insert(uint32_t owner, int id) {
+        Entry e{owner, id};
+        delta_.insert(upper_bound(delta_.begin(), delta_.end(), e, less), e);
+        if (delta_.size() < kDelta) return;
+        vector<Entry> merged(base_.size() + delta_.size());
+        merge(base_.begin(), base_.end(), delta_.begin(), delta_.end(), merged.begin(), less);
+        base_.swap(merged);
+        delta_.clear();
+    }
+
+    // Bulk insert: one sort of the new entries (plus the delta) and one
+    // merge pass into the base.
+    void insertMany(vector<Entry> add) {
+        if (add.size() < kDelta) { for (const Entry &e : add) insert(e.owner, e.id); return; }
+        add.insert(add.end(), delta_.begin(), delta_.end());
+        sortByName(add);
+        vector<Entry> merged(base_.size() + add.size());
+        merge(base_.begin(), base_.end(), add.begin(), add.end(), merged.begin(), less);
+        base_.swap(merged);
+        delta_.clear();
+    }
+
+    void build(vector<Entry> all) {
+        sortByName(all);
+        base_.swap(all);
+        delta_.clear();
+    }
+
+    // Matches ordered by (owner, id); at most limit of them.
+    vector<OwnerMatch> find(string_view key, bool exact, size_t limit) const {
+        vector<Entry> a, b, all;
+        scan(base_, key, exact, limit, a);
+        scan(delta_, key, exact, limit, b);
+        all.resize(a.size() + b.size());
+        merge(a.begin(), a.end(), b.begin(), b.end(), all.begin(), less);
+        vector<OwnerMatch> out;
+        for (size_t i = 0; i < all.size() && i < limit; ++i) out.push_back({all[i].id, ownerNames().get(all[i].owner)});
+        return out;
+    }
+};
+
+// ---------------- Binary snapshot ----------------
+// accounts.snap: a versioned, checksummed image of the bank that can be
+// mmap'ed and served in place. Layout (native little-endian):
+//   SnapHeader | SnapRecord[count] (sorted by id) | owner-name heap
+// Records are fixed width so record i is found by arithmetic; owner names
+// are (offset, length) into the heap. open() only validates the header, so
+// mapping is O(1) regardless of size; verify() checks the body checksum.
+struct SnapHeader {
+    char magic[8];            // "BANKSNAP"
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t count;
+    int64_t nextId;
+    uint64_t heapSize;
+    uint64_t lastLsn;         // last WAL record reflected in this snapshot
+    uint64_t bodyChecksum;    // over records + heap
+    uint64_t headerChecksum;  // over this header with headerChecksum = 0
+};
+
+struct SnapRecord {
+    int32_t id;
+    uint32_t ownerLen;
+    uint64_t ownerOff;
+    int64_t balanceCents;
+    uint64_t salt;
+    uint64_t pinHash;
+    uint32_t pinCost;
+    uint32_t reserved;
+};
+static_assert(sizeof(SnapRecord) == 48, "snapshot record layout");
+static_assert(sizeof(size_t) == sizeof(uint64_t), "salt/pinHash are stored as 64-bit");
+
+static uint64_t checksum64(const void *data, size_t n, uint64_t h = 0x9E3779B97F4A7C15ULL) {
+    // 8 bytes per step multiply-xorshift; not cryptographic, catches torn/corrupt files.
+    const unsigned char *p = (const unsigned char *)data;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t w; memcpy(&w, p, 8);
+        h = (h ^ w) * 0x100000001B3ULL; h ^= h >> 29;
+    }
+    for (; n > 0; ++p, --n) { h = (h ^ *p) * 0x100000001B3ULL; h ^= h >> 29; }
+    return h;
+}
+
+class SnapshotFile {
+    static constexpr uint32_t kVersion = 3; // v3: per-record pinCost; older files fall back to the TSV
+    const unsigned char *base_ = nullptr;
+    size_t len_ = 0;
+    const SnapHeader *hdr_ = nullptr;
+    const SnapRecord *recs_ = nullptr;
+    const char *heap_ = nullptr;
+
+    static uint64_t headerSum(SnapHeader h) { h.headerChecksum = 0; return checksum64(&h, sizeof h); }
+public:
+    SnapshotFile() = default;
+    SnapshotFile(const SnapshotFile &) = delete;
+    SnapshotFile& operator=(const SnapshotFile &) = delete;
+    ~SnapshotFile() { if (base_) munmap((void *)base_, len_); }
+
+    // Maps path read-only and validates the header. O(1).
+    bool open(const string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapHeader)) { ::close(fd); return false; }
+        void *m = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED) return false;
+        base_ = (const unsigned char *)m; len_ = (size_t)st.st_size;
+        hdr_ = (const SnapHeader *)base_;
+        const SnapHeader &h = *hdr_;
+        bool ok = memcmp(h.magic, "BANKSNAP", 8) == 0 && h.version == kVersion && h.recordSize == sizeof(SnapRecord)
+               && h.headerChecksum == headerSum(h)
+               && h.count <= (len_ - sizeof h) / sizeof(SnapRecord)
+               && sizeof h + h.count * sizeof(SnapRecord) + h.heapSize == len_;
+        if (!ok) { munmap(m, len_); base_ = nullptr; len_ = 0; return false; }
+        recs_ = (const SnapRecord *)(base_ + sizeof h);
+        heap_ = (const char *)(recs_ + h.count);
+        return true;
+    }
+
+    // Full body checksum. O(N); run on demand, not at startup.
+    bool verify() const {
+        return checksum64(recs_, len_ - sizeof(SnapHeader)) == hdr_->bodyChecksum;
+    }
+
+    size_t size() const { return (size_t)hdr_->count; }
+    int nextId() const { return (int)hdr_->nextId; }
+    uint64_t lastLsn() const { return hdr_->lastLsn; }
+    const SnapRecord& operator[](size_t i) const { return recs_[i]; }
+
+    // Records are sorted by id and usually dense, so probe id - firstId
+    // first and fall back to a binary search.
+    const SnapRecord* find(int id) const {
+        size_t n = size();
+        if (n == 0) return nullptr;
+        long long guess = (long long)id - recs_[0].id;
+        if (guess >= 0 && (size_t)guess < n && recs_[guess].id == id) return &recs_[guess];
+        const SnapRecord *it = lower_bound(recs_, recs_ + n, id, [](const SnapRecord &r, int v) { return r.id < v; });
+        return it != recs_ + n && it->id == id ? it : nullptr;
+    }
+
+    string_view owner(const SnapRecord &r) const {
+        if (r.ownerOff > hdr_->heapSize || r.ownerLen > hdr_->heapSize - r.ownerOff) return {};
+        return string_view(heap_ + r.ownerOff, r.ownerLen);
+    }
+
+    // Writes recs (sorted here by id) + heap to path.tmp and renames it over
+    // path, so an existing mapping of path stays valid.
+    static bool write(const string &path, vector<SnapRecord> &recs, const string &heap, int nextId, uint64_t lastLsn) {
+        sort(recs.begin(), recs.end(), [](const SnapRecord &a, const SnapRecord &b) { return a.id < b.id; });
+        SnapHeader h{};
+        memcpy(h.magic, "BANKSNAP", 8);
+        h.version = kVersion; h.recordSize = sizeof(SnapRecord);
+        h.count = recs.size(); h.nextId = nextId; h.heapSize = heap.size(); h.lastLsn = lastLsn;
+        h.bodyChecksum = checksum64(heap.data(), heap.size(),
+                                      checksum64(recs.data(), recs.size() * sizeof(SnapRecord)));
+        h.headerChecksum = headerSum(h);
+        const string tmp = path + ".tmp";
+        ofstream out(tmp, ios::binary | ios::trunc);
+        if (!out) return false;
+        out.write((const char *)&h, sizeof h);
+        out.write((const char *)recs.data(), (streamsize)(recs.size() * sizeof(SnapRecord)));
+        out.write(heap.data(), (streamsize)heap.size());
+        out.close();
+        if (!out) { std::remove(tmp.c_str()); return false; }
+        return std::rename(tmp.c_str(), path.c_str()) == 0;
+    }
+};
+
+// ---------------- Write-ahead log ----------------
+// accounts.wal: append-only log of every createAccount, deposit, withdraw,
+// transfer and setPin, so a crash loses at most the configured group-commit window.
+// File = "BANKWAL1" magic, then records:
+//   u32 bodyLen | u64 checksum(body) | body = u64 lsn, u8 op, i32 id, payload
+// LSNs increase across truncations; the snapshot header records the last
+// LSN it contains, and recovery replays only records after it.
+// XferOut/XferIn are the two halves of a cross-shard transfer (see ShardedBank).
+enum class WalOp : uint8_t { Create = 1, Deposit = 2, Withdraw = 3, SetPin = 4, Transfer = 5, Batch = 6, XferOut = 7, XferIn = 8 };
+
+// Decoded record handed to replay callbacks (owner points into the read buffer).
+struct WalEntry {
+    uint64_t lsn; WalOp op; int32_t id;
+    int64_t cents;            // Deposit/Withdraw/Transfer
+    int32_t toId;             // Transfer (id is the source); XferOut/XferIn: the other account
+    uint64_t txid;            // XferOut/XferIn
+    uint64_t salt, pinHash;   // Create (both), SetPin (pinHash)
+    uint8_t pinCost;          // Create, SetPin (0 in logs from before the KDF)
+    string_view owner;        // Create
+    string_view items;        // Batch: id is the item count, each item kBatchItem bytes
+};
+
+// Batch item layout: u8 op (Deposit/Withdraw/Transfer), i32 id, i32 toId, i64 cents.
+static constexpr size_t kBatchItem = 17;
+
+struct WalOptions {
+    // None: write() in 64 KB batches, never fsync (OS crash can lose data).
+    // Group: fsync once groupRecords records are pending or groupMs has
+    //        passed, whichever is first (a background flusher covers the
+    //        time bound). Always: write() + fsync() per record.
+    enum class Sync { None, Group, Always } sync = Sync::Group;
+    size_t groupRecords = 64;
+    int groupMs = 5;
+};
+
+static const char* walSyncName(WalOptions::Sync s) {
+    return s == WalOptions::Sync::None ? "none" : s == WalOptions::Sync::Group ? "group" : "always";
+}
+
+class WriteAheadLog {
+    static constexpr char kMagic[9] = "BANKWAL1";
+    static constexpr size_t kHeader = 4 + 8, kBufferBytes = 1 << 16;
+    int fd_ = -1;
+    string path_;
+    WalOptions opt_;
+    mutex mu_;
+    condition_variable cv_;
+    string buf_;             // encoded records not yet written
+    size_t unsynced_ = 0;    // records written or buffered since the last fsync
+    bool stop_ = false, ioError_ = false;
+    thread flusher_;
+
+    void flushLocked(bool sync) {
+        const char *p = buf_.data(); size_t n = buf_.size();
+        while (n > 0) {
+            ssize_t w = ::write(fd_, p, n);
+            if (w < 0) { if (errno == EINTR) continue; ioError_ = true; break; }
+            p += w; n -= (size_t)w;
+        }
+        buf_.clear();
+        if (sync && unsynced_ > 0) { if (::fsync(fd_) != 0) ioError_ = true; unsynced_ = 0; }
+    }
+
+    void append(uint64_t lsn, WalOp op, int32_t id, const void *payload, size_t len) {
+        const uint32_t body = (uint32_t)(8 + 1 + 4 + len);
+        lock_guard<mutex> lk(mu_);
+        size_t at = buf_.size();
+        buf_.resize(at + kHeader + body);
+        char *r = &buf_[at], *b = r + kHeader;
+        memcpy(b, &lsn, 8); b[8] = (char)op; memcpy(b + 9, &id, 4); memcpy(b + 13, payload, len);
+        uint64_t sum = checksum64(b, body);
+        memcpy(r, &body, 4); memcpy(r + 4, &sum, 8);
+        ++unsynced_;
+        switch (opt_.sync) {
+            case WalOptions::Sync::Always: flushLocked(true); break;
+            case WalOptions::Sync::Group:
+                if (unsynced_ >= opt_.groupRecords) flushLocked(true);
+                else if (unsynced_ == 1) cv_.notify_one(); // start the groupMs clock
+                break;
+            case WalOptions::Sync::None: if (buf_.size() >= kBufferBytes) flushLocked(false); break;
+        }
+    }
+
+    void flusherLoop() {
+        unique_lock<mutex> lk(mu_);
+        while (!stop_) {
+            cv_.wait(lk, [&] { return stop_ || unsynced_ > 0; });
+            if (stop_) break;
+            cv_.wait_for(lk, chrono::milliseconds(opt_.groupMs), [&] { return stop_ || unsynced_ == 0; });
+            flushLocked(true);
+        }
+    }
+public:
+    WriteAheadLog() = default;
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog &) = delete;
+    ~WriteAheadLog() { close(); }
+
+    // Opens (creating if needed) path for appending.
+    bool open(const string &path, WalOptions opt) {
+        opt_ = opt; path_ = path;
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (fd_ < 0) return false;
+        struct stat st; char magic[8];
+        bool ok = fstat(fd_, &st) == 0;
+        if (ok && st.st_size == 0) ok = ::write(fd_, kMagic, 8) == 8 && ::fsync(fd_) == 0;
+        else if (ok) ok = ::pread(fd_, magic, 8, 0) == 8 && memcmp(magic, kMagic, 8) == 0; // never append to a non-WAL
+        if (!ok) { ::close(fd_); fd_ = -1; return false; }
+        if (opt_.sync == WalOptions::Sync::Group) flusher_ = thread([this] { flusherLoop(); });
+        return true;
+    }
+
+    void close() {
+        if (fd_ < 0) return;
+        { lock_guard<mutex> lk(mu_); stop_ = true; }
+        cv_.notify_all();
+        if (flusher_.joinable()) flusher_.join();
+        lock_guard<mutex> lk(mu_);
+        flushLocked(true);
+        ::close(fd_); fd_ = -1;
+    }
+
+    // Create: salt, pinHash, u16 owner length, owner, u8 pinCost.
+    // The owner is at most kMaxOwnerBytes (Bank checks before logging).
+    void logCreate(uint64_t lsn, int id, string_view owner, uint64_t salt, uint64_t pinHash, uint8_t pinCost) {
+        const uint16_t n = (uint16_t)owner.size();
+        string p(19 + owner.size(), '\0');
+        memcpy(&p[0], &salt, 8); memcpy(&p[8], &pinHash, 8); memcpy(&p[16], &n, 2); memcpy(&p[18], owner.data(), n);
+        p[18 + n] = (char)pinCost;
+        append(lsn, WalOp::Create, id, p.data(), p.size());
+    }
+    void logAmount(uint64_t lsn, WalOp op, int id, int64_t cents) { append(lsn, op, id, &cents, 8); }
+    void logSetPin(uint64_t lsn, int id, uint64_t pinHash, uint8_t pinCost) {
+        char p[9];
+        memcpy(p, &pinHash, 8); p[8] = (char)pinCost;
+        append(lsn, WalOp::SetPin, id, p, sizeof p);
+    }
+    // One record for both legs, so replay applies all of a transfer or none.
+    void logTransfer(uint64_t lsn, int from, int to, int64_t cents) {
+        char p[12];
+        memcpy(p, &to, 4); memcpy(p + 4, &cents, 8);
+        append(lsn, WalOp::Transfer, from, p, sizeof p);
+    }
+
+    // One half of a cross-shard transfer: u64 txid, i32 other account, i64 cents.
+    void logXfer(uint64_t lsn, WalOp op, int id, uint64_t txid, int other, int64_t cents) {
+        char p[20];
+        memcpy(p, &txid, 8); memcpy(p + 8, &other, 4); memcpy(p + 12, &cents, 8);
+        append(lsn, op, id, p, sizeof p);
+    }
+
+    // Many successful balance ops as one record: one checksum, one LSN, and
+    // replay applies all of them or none.
+    void logBatch(uint64_t lsn, int32_t count, const string &items) { append(lsn, WalOp::Batch, count, items.data(), items.size()); }
+
+    // Forces everything appended so far to disk.
+    void sync() { lock_guard<mutex> lk(mu_); flushLocked(true); }
+
+    // Drops every record (after a checkpoint has captured them).
+    bool truncate() {
+        lock_guard<mutex> lk(mu_);
+        flushLocked(false);
+        return ::ftruncate(fd_, 8) == 0 && ::fsync(fd_) == 0;
+    }
+
+    // Moves every record logged so far to segment `to` and continues in a
+    // fresh file at the original path, so a checkpoint can later delete
+    // exactly the records it captured. If `to` is left over from a failed
+    // checkpoint, the current records are appended to it instead.
+    bool rotate(const string &to) {
+        lock_guard<mutex> lk(mu_);
+        flushLocked(false);
+        if (::fsync(fd_) != 0) { ioError_ = true; return false; }
+        unsynced_ = 0;
+        struct stat st;
+        if (::stat(to.c_str(), &st) != 0) {
+            if (std::rename(path_.c_str(), to.c_str()) != 0) return false;
+            int fd = ::open(path_.c_str(), O_RDWR | O_CREAT | O_APPEND | O_TRUNC, 0644);
+            if (fd < 0 || ::write(fd, kMagic, 8) != 8 || ::fsync(fd) != 0) { if (fd >= 0) ::close(fd); ioError_ = true; return false; }
+            ::close(fd_); fd_ = fd;
+            return true;
+        }
+        ifstream in(path_, ios::binary);
+        string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        int fd = ::open(to.c_str(), O_WRONLY | O_APPEND);
+        if (fd < 0) return false;
+        bool ok = data.size() <= 8 || ::write(fd, data.data() + 8, data.size() - 8) == (ssize_t)(data.size() - 8);
+        ok = ::fsync(fd) == 0 && ok;
+        ::close(fd);
+        return ok && ::ftruncate(fd_, 8) == 0 && ::fsync(fd_) == 0;
+    }
+
+    bool ok() const { return fd_ >= 0 && !ioError_; }
+
+    // Calls f(const WalEntry&) for each intact record in path, in order.
+    // Stops at the first torn/corrupt record and cuts the file back to the
+    // last good one so later appends don't land behind garbage. Returns
+    // false if the file exists but isn't a WAL.
+    template <class F> static bool replay(const string &path, F &&f) {
+        ifstream in(path, ios::binary);
+        if (!in) return true; // no log yet
+        string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        if (data.empty()) return true;
+        if (data.size() < 8 || data.compare(0, 8, kMagic, 8) != 0) return false;
+        size_t pos = 8;
+        while (data.size() - pos >= kHeader + 13) {
+            uint32_t body; uint64_t sum;
+            memcpy(&body, &data[pos], 4); memcpy(&sum, &data[pos + 4], 8);
+            if (body < 13 || body > data.size() - pos - kHeader) break;
+            const char *b = &data[pos + kHeader];
+            if (checksum64(b, body) != sum) break;
+            WalEntry e{};
+            memcpy(&e.lsn, b, 8); e.op = (WalOp)b[8]; memcpy(&e.id, b + 9, 4);
+            const char *p = b + 13; size_t len = body - 13;
+            if ((e.op == WalOp::Deposit || e.op == WalOp::Withdraw) && len == 8) memcpy(&e.cents, p, 8);
+            else if (e.op == WalOp::SetPin && (len == 8 || len == 9)) { memcpy(&e.pinHash, p, 8); e.pinCost = len == 9 ? (uint8_t)p[8] : 0; }
+            else if (e.op == WalOp::Transfer && len == 12) { memcpy(&e.toId, p, 4); memcpy(&e.cents, p + 4, 8); }
+            else if ((e.op == WalOp::XferOut || e.op == WalOp::XferIn) && len == 20) { memcpy(&e.txid, p, 8); memcpy(&e.toId, p + 8, 4); memcpy(&e.cents, p + 12, 8); }
+            else if (e.op == WalOp::Batch && e.id >= 0 && len == (size_t)e.id * kBatchItem) e.items = string_view(p, len);
+            else if (e.op == WalOp::Create && len >= 18) {
+                uint16_t n; memcpy(&e.salt, p, 8); memcpy(&e.pinHash, p + 8, 8); memcpy(&n, p + 16, 2);
+                if (len != 18 + (size_t)n && len != 19 + (size_t)n) break;
+                e.owner = string_view(p + 18, n);
+                e.pinCost = len == 19 + (size_t)n ? (uint8_t)p[18 + n] : 0;
+            } else break;
+            f(e);
+            pos += kHeader + body;
+        }
+        if (pos < data.size() && ::truncate(path.c_str(), (off_t)pos) != 0) return false;
+        return true;
+    }
+};
+
+// ---------------- Session cache ----------------
+// Successful PIN verifications keyed by a random session token, so
+// repeated operations by an authenticated client skip the KDF. Bounded
+// (once full, the oldest session is evicted) and time-limited (fixed TTL
+// from issue, so issue order is also expiry order). Each entry remembers
+// the pinHash it was issued against; a PIN change therefore invalidates
+// the account's sessions without any scan.
+class SessionCache {
+    struct Entry { int id; size_t pinHash; chrono::steady_clock::time_point expires; };
+    mutable mutex mu_;
+    unordered_map<uint64_t, Entry> map_;
+    deque<uint64_t> order_; // tokens in issue order; may hold already-ended ones
+    size_t capacity_ = 65536;
+    chrono::milliseconds ttl_{15 * 60 * 1000};
+
+    void evictLocked(chrono::steady_clock::time_point now) {
+        while (!order_.empty()) {
+            auto it = map_.find(order_.front());
+            if (order_.size() <= capacity_ && it != map_.end() && it->second.expires > now) break;
+            if (it != map_.end()) map_.erase(it);
+            order_.pop_front();
+        }
+    }
+public:
+    void configure(size_t capacity, chrono::milliseconds ttl) {
+        lock_guard<mutex> lk(mu_);
+        capacity_ = max<size_t>(capacity, 1); ttl_ = ttl;
+        evictLocked(chrono::steady_clock::now());
+    }
+
+    uint64_t issue(int id, size_t pinHash) {
+        uint64_t token;
+        do token = makeSalt(); while (token == 0);
+        auto now = chrono::steady_clock::now();
+        lock_guard<mutex> lk(mu_);
+        map_[token] = Entry{id, pinHash, now + ttl_};
+        order_.push_back(token);
+        evictLocked(now);
+        return token;
+    }
+
+    bool check(uint64_t token, int id, size_t pinHash) {
+        lock_guard<mutex> lk(mu_);
+        auto it = map_.find(token);
+        if (it == map_.end()) return false;
+        if (it->second.id != id) return false;
+        if (it->second.pinHash != pinHash || it->second.expires <= chrono::steady_clock::now()) { map_.erase(it); return false; }
+        return true;
+    }
+
+    void end(uint64_t token) { lock_guard<mutex> lk(mu_); map_.erase(token); }
+    size_t size() const { lock_guard<mutex> lk(mu_); return map_.size(); }
+};
+
+// ---------------- Operation stats ----------------
+// Latency histograms per operation plus decline counters. Each thread
+// records into its own block (plain relaxed load + store, no RMW, no lock);
+// statsSnapshot() sums every live block plus those of exited threads. A
+// block is recycled when its thread exits, so short-lived threads don't
+// leak one each.
+// Buckets are HDR-style log-linear: 8 sub-buckets per power of two, so a
+// reported value (the bucket's upper bound) is within 12.5% of the truth,
+// in 496 buckets from 1 ns to 2^64 ns.
+// Off by default; main() turns it on unless BANK_STATS=0 is in the
+// environment (disabled: one relaxed load and branch per operation).
+// Building with -DBANK_STATS=0 compiles every probe out.
+#ifndef BANK_STATS
+#define BANK_STATS 1
+#endif
+
+enum class StatOp : uint8_t { Login, Deposit, Withdraw, Transfer, Save, Load };
+// The first kStatDeclines counters are declines; HistoryDropped counts
+// statement entries lost to a ring lap (see TransactionHistory).
+enum class StatCounter : uint8_t { InsufficientFunds, BadPin, HistoryDropped };
+static constexpr size_t kStatOps = 6, kStatCounters = 3, kStatDeclines = 2;
+static const char *const kStatOpNames[kStatOps] = {"login", "deposit", "withdraw", "transfer", "save", "load"};
+static const char *const kStatCounterNames[kStatCounters] = {"insufficient_funds", "bad_pin", "history_dropped"};
+
+static atomic<bool> g_statsEnabled{false};
+
+struct LatencyBuckets {
+    static constexpr unsigned kSubBits = 3, kSub = 1u << kSubBits;
+    static constexpr size_t kCount = (64 - kSubBits + 1) * kSub;
+    static size_t index(uint64_t v) {
+        if (v < kSub) return (size_t)v;
+        unsigned e = 63 - (unsigned)__builtin_clzll(v);
+        return (size_t)(e - kSubBits + 1) * kSub + (size_t)((v >> (e - kSubBits)) & (kSub - 1));
+    }
+    static uint64_t upper(size_t i) {
+        if (i < kSub) return i;
+        unsigned e = (unsigned)(i / kSub) + kSubBits - 1, shift = e - kSubBits;
+        uint64_t lo = (uint64_t)(kSub + i % kSub) << shift;
+        return lo + ((uint64_t(1) << shift) - 1);
+    }
+};
+
+// Merged view; plain numbers.
+struct StatsSnapshot {
+    array<array<uint64_t, LatencyBuckets::kCount>, kStatOps> hist{};
+    array<uint64_t, kStatOps> count{}, sumNs{}, maxNs{};
+    array<uint64_t, kStatCounters> counters{};
+
+    // Latency (ns) at quantile q of op, to bucket precision.
+    uint64_t percentile(StatOp op, double q) const {
+        size_t o = (size_t)op;
+        if (!count[o]) return 0;
+        uint64_t want = max<uint64_t>(1, (uint64_t)ceil(q * (double)count[o])), seen = 0;
+        for (size_t i = 0; i < LatencyBuckets::kCount; ++i)
+            if ((seen += hist[o][i]) >= want) return min(LatencyBuckets::upper(i), maxNs[o]);
+        return maxNs[o];
+    }
+};
+
+class StatsRegistry {
+public:
+    struct Block {
+        atomic<uint64_t> hist[kStatOps][LatencyBuckets::kCount];
+        atomic<uint64_t> sumNs[kStatOps], maxNs[kStatOps], counters[kStatCounters];
+        Block() { clear(); }
+        void clear() {
+            for (auto &h : hist) for (auto &b : h) b.store(0, memory_order_relaxed);
+            for (size_t o = 0; o < kStatOps; ++o) { sumNs[o].store(0, memory_order_relaxed); maxNs[o].store(0, memory_order_relaxed); }
+            for (auto &c : counters) c.store(0, memory_order_relaxed);
+        }
+    };
+private:
+    mutex mu_;
+    vector<Block *> live_, free_;
+    StatsSnapshot retired_; // totals of blocks whose threads exited
+
+    static void addTo(StatsSnapshot &s, const Block &b) {
+        for (size_t o = 0; o < kStatOps; ++o) {
+            for (size_t i = 0; i < LatencyBuckets::kCount; ++i) {
+                uint64_t n = b.hist[o][i].load(memory_order_relaxed);
+                s.hist[o][i] += n; s.count[o] += n;
+            }
+            s.sumNs[o] += b.sumNs[o].load(memory_order_relaxed);
+            s.maxNs[o] = max(s.maxNs[o], b.maxNs[o].load(memory_order_relaxed));
+        }
+        for (size_t c = 0; c < kStatCounters; ++c) s.counters[c] += b.counters[c].load(memory_order_relaxed);
+    }
+public:
+    Block* acquire() {
+        lock_guard<mutex> lk(mu_);
+        Block *b;
+        if (!free_.empty()) { b = free_.back(); free_.pop_back(); } else b = new Block;
+        live_.push_back(b);
+        return b;
+    }
+    void release(Block *b) {
+        lock_guard<mutex> lk(mu_);
+        addTo(retired_, *b);
+        b->clear();
+        live_.erase(find(live_.begin(), live_.end(), b));
+        free_.push_back(b);
+    }
+    StatsSnapshot snapshot() {
+        lock_guard<mutex> lk(mu_);
+        StatsSnapshot s = retired_;
+        for (Block *b : live_) addTo(s, *b);
+        return s;
+    }
+    // Zeroes everything; samples racing with it may land on either side.
+    void reset() {
+        lock_guard<mutex> lk(mu_);
+        retired_ = StatsSnapshot{};
+        for (Block *b : live_) b->clear();
+    }
+};
+
+// Never destroyed: threads may still exit (and release) during static teardown.
+static StatsRegistry& statsRegistry() { static StatsRegistry *r = new StatsRegistry; return *r; }
+static StatsSnapshot statsSnapshot() { return statsRegistry().snapshot(); }
+static void statsReset() { statsRegistry().reset(); }
+
+#if BANK_STATS
+struct StatsHandle {
+    StatsRegistry::Block *block = nullptr;
+    ~StatsHandle() { if (block) statsRegistry().release(block); }
+};
+static thread_local StatsHandle t_stats;
+
+static StatsRegistry::Block& myStats() {
+    if (!t_stats.block) t_stats.block = statsRegistry().acquire();
+    return *t_stats.block;
+}
+// Only the owning thread writes its block, so load + store is enough.
+static void bump(atomic<uint64_t> &a, uint64_t by) { a.store(a.load(memory_order_relaxed) + by, memory_order_relaxed); }
+
+static void statCount(StatCounter c) {
+    if (g_statsEnabled.load(memory_order_relaxed)) bump(myStats().counters[(size_t)c], 1);
+}
+
+// Times its scope into op's histogram when stats are on.
+class StatTimer {
+    StatOp op_;
+    bool on_;
+    chrono::steady_clock::time_point t0_;
+public:
+    explicit StatTimer(StatOp op) : op_(op), on_(g_statsEnabled.load(memory_order_relaxed)) { if (on_) t0_ = chrono::steady_clock::now(); }
+    StatTimer(const StatTimer &) = delete;
+    StatTimer& operator=(const StatTimer &) = delete;
+    ~StatTimer() {
+        if (!on_) return;
+        uint64_t ns = (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t0_).count();
+        StatsRegistry::Block &b = myStats();
+        size_t o = (size_t)op_;
+        bump(b.hist[o][LatencyBuckets::index(ns)], 1);
+        bump(b.sumNs[o], ns);
+        if (ns > b.maxNs[o].load(memory_order_relaxed)) b.maxNs[o].store(ns, memory_order_relaxed);
+    }
+};
+#else
+static void statCount(StatCounter) {}
+struct StatTimer { explicit StatTimer(StatOp) {} };
+#endif
+
+// Passes s through, counting it if it is a funds decline.
+static OpStatus countDecline(OpStatus s) {
+    if (s == OpStatus::InsufficientFunds) statCount(StatCounter::InsufficientFunds);
+    return s;
+}
+
+// Human-readable table: count, mean and percentiles per operation, then declines.
+static void formatStatsTable(const StatsSnapshot &s, string &out) {
+    char line[160];
+    snprintf(line, sizeof line, "%-10s %10s %10s %10s %10s %10s %10s\n", "op", "count", "mean us", "p50 us", "p99 us", "p99.9 us", "max us");
+    out += line;
+    for (size_t o = 0; o < kStatOps; ++o) {
+        StatOp op = (StatOp)o;
+        double mean = s.count[o] ? (double)s.sumNs[o] / (double)s.count[o] / 1000 : 0;
+        snprintf(line, sizeof line, "%-10s %10llu %10.2f %10.2f %10.2f %10.2f %10.2f\n", kStatOpNames[o], (unsigned long long)s.count[o], mean,
+                 (double)s.percentile(op, 0.5) / 1000, (double)s.percentile(op, 0.99) / 1000, (double)s.percentile(op, 0.999) / 1000, (double)s.maxNs[o] / 1000);
+        out += line;
+    }
+    for (size_t c = 0; c < kStatDeclines; ++c) { out += "declined ("; out += kStatCounterNames[c]; out += "): " + to_string(s.counters[c]) + "\n"; }
+    out += "history entries dropped: " + to_string(s.counters[(size_t)StatCounter::HistoryDropped]) + "\n";
+}
+
+// Prometheus text exposition format (version 0.0.4).
+static void formatPrometheus(const StatsSnapshot &s, string &out) {
+    static const double kLe[] = {1e-6, 2.5e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3, 5e-3, 1e-2, 0.1, 1, 10};
+    char line[160];
+    out += "# HELP bank_op_duration_seconds Latency of Bank operations.\n# TYPE bank_op_duration_seconds histogram\n";
+    for (size_t o = 0; o < kStatOps; ++o) {
+        size_t i = 0;
+        uint64_t cum = 0;
+        for (double le : kLe) {
+            // Buckets whose whole range is <= le (so each count is a lower bound).
+            while (i < LatencyBuckets::kCount && (double)LatencyBuckets::upper(i) <= le * 1e9) cum += s.hist[o][i++];
+            snprintf(line, sizeof line, "bank_op_duration_seconds_bucket{op=\"%s\",le=\"%g\"} %llu\n", kStatOpNames[o], le, (unsigned long long)cum);
+            out += line;
+        }
+        snprintf(line, sizeof line, "bank_op_duration_seconds_bucket{op=\"%s\",le=\"+Inf\"} %llu\n", kStatOpNames[o], (unsigned long long)s.count[o]);
+        out += line;
+        snprintf(line, sizeof line, "bank_op_duration_seconds_sum{op=\"%s\"} %.9f\n", kStatOpNames[o], (double)s.sumNs[o] / 1e9);
+        out += line;
+        snprintf(line, sizeof line, "bank_op_duration_seconds_count{op=\"%s\"} %llu\n", kStatOpNames[o], (unsigned long long)s.count[o]);
+        out += line;
+    }
+    out += "# HELP bank_declines_total Operations refused by a business rule.\n# TYPE bank_declines_total counter\n";
+    for (size_t c = 0; c < kStatDeclines; ++c) {
+        snprintf(line, sizeof line, "bank_declines_total{reason=\"%s\"} %llu\n", kStatCounterNames[c], (unsigned long long)s.counters[c]);
+        out += line;
+    }
+    snprintf(line, sizeof line, "# HELP bank_history_dropped_total Statement entries lost to a history ring lap.\n"
+             "# TYPE bank_history_dropped_total counter\nbank_history_dropped_total %llu\n",
+             (unsigned long long)s.counters[(size_t)StatCounter::HistoryDropped]);
+    out += line;
+}
+
+// ---------------- Update gate ----------------
+// Distributed shared lock for the lock-free balance mode. Updaters take the
+// shared side, which only touches a per-thread slot's cache line (threads
+// hash onto kSlots padded counters), so it costs no cross-core traffic
+// unless a cut is pending. The exclusive side (checkpoints, point-in-time
+// saves) raises a flag and waits for every slot to drain.
+class UpdateGate {
+    static constexpr size_t kSlots = 64;
+    struct alignas(64) Slot { atomic<int> n{0}; };
+    Slot slots_[kSlots];
+    atomic<bool> closed_{false};
+    mutex exclusiveMu_;
+
+    static size_t mySlot() {
+        static thread_local size_t slot = hash<thread::id>{}(this_thread::get_id()) % kSlots;
+        return slot;
+    }
+public:
+    size_t enter() {
+        size_t s = mySlot();
+        while (true) {
+            slots_[s].n.fetch_add(1, memory_order_seq_cst);
+            if (!closed_.load(memory_order_seq_cst)) return s;
+            slots_[s].n.fetch_sub(1, memory_order_release);
+            while (closed_.load(memory_order_acquire)) this_thread::yield();
+        }
+    }
+    void leave(size_t s) { slots_[s].n.fetch_sub(1, memory_order_release); }
+
+    void close() {
+        exclusiveMu_.lock();
+        closed_.store(true, memory_order_seq_cst);
+        for (auto &sl : slots_) while (sl.n.load(memory_order_acquire) != 0) this_thread::yield();
+    }
+    void open() { closed_.store(false, memory_order_release); exclusiveMu_.unlock(); }
+
+    struct Scope {
+        UpdateGate &g; size_t s;
+        explicit Scope(UpdateGate &gate) : g(gate), s(gate.enter()) {}
+        ~Scope() { g.leave(s); }
+    };
+};
+
+// ---------------- Transaction history ----------------
+// Statement lines for every balance change since the process started
+// (kept in memory only; the WAL and snapshot hold balances, not history).
+// The entries of every account share one append-only log of 32-byte
+// nodes, allocated 64K at a time in segments that never move. Each node
+// links to the same account's previous node, and a paged table keyed by
+// account ID holds each account's newest node, so last() and range() walk
+// one account's chain and never touch anyone else's entries.
+// The log is a ring of a fixed number of segments: once it is full, the
+// oldest segment is reused for new entries, and chains end where it was.
+// Appends are lock-free (fetch_add for the slot, CAS to link it in);
+// reusing a segment closes gate_, which waits until no append or query is
+// inside the log. An appender stalled for a whole lap finds its slot
+// already reused and drops the entry (counted as history_dropped in the
+// stats) even though its balance change went through, so a statement can
+// miss a line; nonzero history_dropped means statements may not reconcile.
+// Entries keep their wall-clock time, but chains are in link order: racing
+// Atomic-mode appends to one account, or a clock step back, can leave a
+// chain briefly out of time order (range() allows for that).
+enum class HistoryType : uint8_t { Deposit, Withdraw, TransferOut, TransferIn, Accrual };
+static const char *const kHistoryTypeNames[] = {"Deposit", "Withdrawal", "Transfer to", "Transfer from", "Interest/fee"};
+
+// cents is the signed change to the account; counterparty is 0 unless a transfer.
+struct HistoryEntry { int64_t timeUs; long long cents; int counterparty; HistoryType type; };
+
+static int64_t unixMicros() {
+    return chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+
+class TransactionHistory {
+    static constexpr unsigned kSegBits = 16;
+    static constexpr uint64_t kSeg = uint64_t(1) << kSegBits;
+    static constexpr int kBase = 1001;
+    static constexpr unsigned kPageBits = 12;
+    static constexpr size_t kPage = size_t(1) << kPageBits, kMaxPages = size_t(1) << 15;
+    struct Node { int64_t timeUs; int64_t cents; uint64_t prev; int32_t other; HistoryType type; }; // prev: index + 1, 0 = none
+    struct Page { atomic<uint64_t> head[kPage]; Page() { for (auto &h : head) h.store(0, memory_order_relaxed); } };
+
+    const uint64_t ring_; // segments kept
+    unique_ptr<atomic<Node*>[]> segs_;
+    atomic<uint64_t> next_{0};  // next log index
+    atomic<uint64_t> ready_{0}; // segments [0, ready_) are allocated / reclaimed
+    atomic<uint64_t> floor_{0}; // oldest live index; moves only while gate_ is closed
+    mutable UpdateGate gate_;
+    mutex growMu_;
+    // account ID -> newest index + 1; IDs outside the dense range go to sparse_
+    unique_ptr<atomic<Page*>[]> pages_{new atomic<Page*>[kMaxPages]()};
+    unordered_map<int, atomic<uint64_t>> sparse_;
+    mutable mutex sparseMu_;
+
+    Node& node(uint64_t i) const { return segs_[(i >> kSegBits) % ring_].load(memory_order_acquire)[i & (kSeg - 1)]; }
+
+    static bool dense(int id) { return id >= kBase && (size_t)(id - kBase) < kPage * kMaxPages; }
+    atomic<uint64_t>& head(int id) {
+        if (!dense(id)) { lock_guard<mutex> lk(sparseMu_); return sparse_[id]; } // node-based: references stay valid
+        size_t k = (size_t)(id - kBase);
+        Page *p = pages_[k >> kPageBits].load(memory_order_acquire);
+        if (!p) {
+            Page *fresh = new Page;
+            if (pages_[k >> kPageBits].compare_exchange_strong(p, fresh, memory_order_acq_rel)) p = fresh;
+            else delete fresh;
+        }
+        return p->head[k & (kPage - 1)];
+    }
+    uint64_t headOf(int id) const {
+        if (!dense(id)) {
+            lock_guard<mutex> lk(sparseMu_);
+            auto it = sparse_.find(id);
+            return it == sparse_.end() ? 0 : it->second.load(memory_order_acquire);
+        }
+        size_t k = (size_t)(id - kBase);
+        Page *p = pages_[k >> kPageBits].load(memory_order_acquire);
+        return p ? p->head[k & (kPage - 1)].load(memory_order_acquire) : 0;
+    }
+
+    // Makes segments up to seg usable; called outside gate_.
+    void prepare(uint64_t seg) {
+        lock_guard<mutex> lk(growMu_);
+        for (uint64_t s = ready_.load(memory_order_relaxed); s <= seg; ++s) {
+            if (s < ring_) segs_[s].store(new Node[kSeg], memory_order_release);
+            else { gate_.close(); floor_.store((s - ring_ + 1) << kSegBits, memory_order_relaxed); gate_.open(); }
+            ready_.store(s + 1, memory_order_release);
+        }
+    }
+
+    // Chains are nearly time-ordered, so the walk stops after
+    // kRangeSlack consecutive entries older than fromUs, not at the first.
+    static constexpr unsigned kRangeSlack = 64;
+    size_t walk(int id, int64_t fromUs, int64_t toUs, size_t limit, vector<HistoryEntry> &out) const {
+        UpdateGate::Scope g(gate_);
+        const uint64_t floor = floor_.load(memory_order_relaxed);
+        size_t added = 0;
+        for (uint64_t i = headOf(id), older = 0; i > floor && added < limit && older < kRangeSlack;) {
+            const Node &n = node(i - 1);
+            if (n.timeUs < fromUs) { ++older; i = n.prev; continue; }
+            older = 0;
+            if (n.timeUs <= toUs) { out.push_back({n.timeUs, n.cents, n.other, n.type}); ++added; }
+            i = n.prev;
+        }
+        return added;
+    }
+public:
+    static constexpr size_t kNodeBytes = sizeof(Node);
+
+    // Keeps at least `entries` of the newest entries (whole segments, two minimum).
+    explicit TransactionHistory(size_t entries)
+        : ring_(max<uint64_t>(2, (entries + kSeg - 1) / kSeg)), segs_(new atomic<Node*>[ring_]()) {}
+    TransactionHistory(const TransactionHistory &) = delete;
+    TransactionHistory& operator=(const TransactionHistory &) = delete;
+    ~TransactionHistory() {
+        for (uint64_t s = 0; s < ring_; ++s) delete[] segs_[s].load(memory_order_relaxed);
+        for (size_t p = 0; p < kMaxPages; ++p) delete pages_[p].load(memory_order_relaxed);
+    }
+
+    void append(int id, HistoryType type, long long cents, int other) {
+        const int64_t now = unixMicros();
+        const uint64_t i = next_.fetch_add(1, memory_order_relaxed);
+        if (ready_.load(memory_order_acquire) <= i >> kSegBits) prepare(i >> kSegBits);
+        atomic<uint64_t> &h = head(id);
+        UpdateGate::Scope g(gate_);
+        if (i < floor_.load(memory_order_relaxed)) { statCount(StatCounter::HistoryDropped); return; } // lapped while stalled
+        Node &n = node(i);
+        n = {now, cents, 0, other, type};
+        uint64_t prev = h.load(memory_order_relaxed);
+        do n.prev = prev; while (!h.compare_exchange_weak(prev, i + 1, memory_order_release, memory_order_relaxed));
+    }
+
+    // Newest first. Each returns how many entries it appended to out.
+    size_t last(int id, size_t n, vector<HistoryEntry> &out) const { return walk(id, INT64_MIN, INT64_MAX, n, out); }
+    // Entries with fromUs <= timeUs <= toUs, newest-linked first. Reads the
+    // entries newer than fromUs plus up to kRangeSlack older ones, so an
+    // entry linked out of time order within that window is still found.
+    size_t range(int id, int64_t fromUs, int64_t toUs, vector<HistoryEntry> &out, size_t limit = SIZE_MAX) const {
+        return walk(id, fromUs, toUs, limit, out);
+    }
+
+    uint64_t appended() const { return next_.load(memory_order_relaxed); }
+    size_t capacity() const { return (size_t)(ring_ * kSeg); }
+    size_t bytes() const { return (size_t)(min(ready_.load(memory_order_relaxed), ring_) * kSeg * sizeof(Node)); }
+};
+
+// ---------------- Bank class ----------------
+struct TransferRequest { int from, to; long long cents; };
+
+// Keyset pagination for Bank::listAccounts. ById pages in ascending ID;
+// ByBalance in descending balance, ties by ascending ID. Pass the cursor a
+// page returned to get the next one; done is set once nothing is left.
+enum class ListOrder { ById, ByBalance };
+struct ListCursor { int id = INT_MIN; long long balance = LLONG_MAX; bool done = false; };
+
+// One balance operation for Bank::applyBatch. toId is only read for Transfer.
+struct BatchOp {
+    enum class Kind : uint8_t { Deposit, Withdraw, Transfer } kind;
+    int id; long long cents; int toId = 0;
+};
+
+// One pass of Bank::accrue. Each balance b >= max(0, minBalanceCents) changes by
+// round(b * rateE8 / 1e8) + flatCents: positive is interest, negative a
+// fee. The rounding is exact integer math, half to even, so the same
+// balances always give the same cents. A fee stops at a zero balance, and
+// a credit past kMaxBalanceCents is skipped; both count as capped.
+struct AccrualRule {
+    long long rateE8 = 0;           // per pass: 0.01% interest is 10000, -1% is -1000000
+    long long flatCents = 0;        // e.g. -500 for a $5 maintenance fee
+    long long minBalanceCents = 0;
+};
+struct AccrualResult { size_t accounts = 0, chunks = 0, capped = 0; long long creditedCents = 0, debitedCents = 0; };
+
+static constexpr long long kAccrualRateMax = 100000000; // |rateE8| <= 100% per pass
+
+// The change rule makes to a balance of cur; false if it leaves it alone.
+static bool accrualNext(const AccrualRule &rule, long long cur, long long &next, bool &capped) noexcept {
+    capped = false;
+    if (cur < rule.minBalanceCents || cur < 0) return false;
+    constexpr long long kDen = 100000000;
+    long long num, q, r;
+    if (!__builtin_mul_overflow(cur, rule.rateE8, &num)) {
+        q = num / kDen; r = num % kDen;
+    } else {
+        __extension__ typedef __int128 wide;
+        wide w = (wide)cur * rule.rateE8;
+        q = (long long)(w / kDen); r = (long long)(w % kDen); num = w < 0 ? -1 : 1;
+    }
+    if (2 * llabs(r) > kDen || (2 * llabs(r) == kDen && (q & 1))) q += num < 0 ? -1 : 1;
+    if (__builtin_add_overflow(cur, q, &next) || __builtin_add_overflow(next, rule.flatCents, &next) || next > kMaxBalanceCents) {
+        capped = true;
+        return false;
+    }
+    if (next < 0) { next = 0; capped = true; }
+    return next != cur;
+}
+
+// Locked: deposit/withdraw take the account's stripe mutex.
+// Atomic: deposit and withdraw are CAS loops on the atomic balance (with
+//         the same "Insufficient funds" and balance-limit checks); no
+//         mutex, so hot accounts don't convoy. PIN changes still use the stripe.
+//         A transfer is a debit CAS then a credit CAS, so in between (and,
+//         if a racing credit fills the destination to kMaxBalanceCents,
+//         until the debit is put back) other threads see the source
+//         already debited: a concurrent withdrawal can be declined for
+//         funds the refused transfer never moved. Transfers check the
+//         destination's headroom first, so only such a race gets there.
+enum class BalanceMode { Locked, Atomic };
+
+struct CheckpointStats {
+    size_t started = 0, completed = 0, failed = 0;
+    double lastForkPauseUs = 0;   // foreground cost: WAL rotate + fork()
+    double lastDurationMs = 0;    // fork -> child reaped
+    double maxDurationMs = 0;
+    uint64_t lastLsn = 0;         // newest LSN captured by a finished checkpoint
+};
+
+// Accounts live in a ChunkedArena: createAccount never copies or moves
+// existing accounts, so an Account* from login/findById (e.g. the one held by
+// accountSession) stays valid while other accounts are created.
+//
+// After openSnapshot(), the mmap'ed snapshot is a read-only base layer:
+// accounts are served from it until findById/login hands out an Account*,
+// at which point that one record is copied into accounts_ (which then
+// shadows the snapshot copy). Untouched accounts are never copied.
+//
+// Thread safety: Bank may be used from many threads. Balance/PIN changes
+// lock one of kStripes striped mutexes picked by account ID (sequential IDs
+// land on different stripes). Lookups are lock-free: the arena and index
+// support one writer alongside any number of readers, and writeMu_
+// serializes the writers (account creation, snapshot copy-in). Creation
+// salts and hashes the PIN before taking writeMu_, so the critical section is
+// just "take an ID, append, publish". Account's own methods are
+// unsynchronized: shared accounts must be changed through Bank. Whole-bank
+// operations (checkpoints) take every lock (lockAll) for a consistent cut.
+class Bank {
+    friend class ShardedBank;
+    static constexpr size_t kStripes = 1024;
+    struct alignas(64) Stripe { mutex m; };
+
+    BalanceMode mode_;
+    const int firstId_, endId_; // IDs are assigned from [firstId_, endId_)
+    mutable UpdateGate gate_; // Atomic mode: lets lockAll() exclude lock-free updaters
+    ChunkedArena<Account> accounts_;
+    AccountIndex index_;
+    mutable unique_ptr<Stripe[]> stripes_{new Stripe[kStripes]};
+    mutable mutex writeMu_;
+    int nextId_;        // simple incremental IDs (writeMu_)
+    unique_ptr<SnapshotFile> snap_;
+    atomic<size_t> snapShadowed_{0}; // snapshot records copied into accounts_
+    unique_ptr<WriteAheadLog> wal_;
+    string walPath_;
+    atomic<uint64_t> lsn_{0}; // newest LSN handed out / replayed
+    uint64_t baseLsn_ = 0;    // LSN already reflected in the loaded snapshot
+    // background checkpoint state (ckptMu_)
+    mutex ckptMu_;
+    pid_t ckptPid_ = -1;
+    uint64_t ckptLsn_ = 0;              // LSN captured by the running checkpoint
+    atomic<uint64_t> ckptBase_{0};      // ... and by the last one started
+    chrono::steady_clock::time_point ckptStart_;
+    CheckpointStats ckptStats_;
+    string autoSnap_, autoTsv_;
+    uint64_t autoEvery_ = 0;
+    SessionCache sessions_;
+    // Owner search index (ownerMu_; writers also hold writeMu_). Built in
+    // bulk by loadFromFile or lazily by the first query after a snapshot
+    // open, and maintained per create whenever it's built.
+    mutable shared_mutex ownerMu_;
+    mutable OwnerIndex owners_;
+    mutable bool ownersReady_ = true; // an empty bank is trivially indexed
+    // Cross-shard transfer halves seen by the last recover(), for ShardedBank
+    // to pair up. covered: the record is already reflected in the snapshot.
+    struct XferHalf { uint64_t txid; int id, other; long long cents; bool out, covered; };
+    vector<XferHalf> xferHalves_;
+    unique_ptr<TransactionHistory> history_; // null: not recorded
+    // Read views (see ReadView). Each update reads viewEpoch_ once, after
+    // taking its stripes (or the gate), and stamps every account it writes
+    // with that epoch; readView() bumps it and then waits out the updates
+    // that read the old value. views_ rises before the bump (falling
+    // mid-update just skips an image nobody reads).
+    struct BeforeImage { uint32_t from, to; long long cents; }; // the balance for pins in [from, to)
+    struct alignas(64) BeforeStripe { mutex m; unordered_multimap<int, BeforeImage> images; };
+    mutable atomic<uint32_t> viewEpoch_{0};
+    mutable atomic<int> views_{0};
+    mutable mutex viewMu_;                        // orders view open/close
+    mutable unique_ptr<BeforeStripe[]> before_;   // allocated by the first view
+
+    static size_t stripeOf(int id) { return (unsigned)id & (kStripes - 1); }
+    mutex& stripe(int id) const { return stripes_[stripeOf(id)].m; }
+
+    // The epoch of the update running on this thread; set by OpEpoch once
+    // the update's stripes (or the gate) are held, so both halves of a
+    // transfer land in the same epoch.
+    static inline thread_local uint32_t t_opEpoch = 0;
+    struct OpEpoch {
+        uint32_t saved;
+        explicit OpEpoch(const Bank &b) : saved(t_opEpoch) { t_opEpoch = b.viewEpoch_.load(memory_order_acquire); }
+        ~OpEpoch() { t_opEpoch = saved; }
+    };
+
+    // Call before changing a's balance, inside an OpEpoch. Hot path: one
+    // compare. The first write to an account in a newer epoch stamps it,
+    // saving the old balance if a view is open; the stamp is published
+    // before the balance store (release), so a reader that sees the new
+    // balance also sees the new epoch.
+    void beforeWrite(Account &a) noexcept {
+        const uint32_t e = t_opEpoch;
+        if (a.epoch_.load(memory_order_acquire) != e) stampEpoch(a, e);
+    }
+    void stampEpoch(Account &a, uint32_t e) noexcept {
+        BeforeStripe *images = views_.load(memory_order_acquire) ? before_.get() : nullptr;
+        if (!images) { a.epoch_.store(e, memory_order_release); return; }
+        BeforeStripe &s = images[stripeOf(a.id_)];
+        lock_guard<mutex> lk(s.m); // Atomic mode: also orders racing first writers
+        uint32_t from = a.epoch_.load(memory_order_relaxed);
+        if (from >= e) return;
+        s.images.emplace(a.id_, BeforeImage{from, e, a.balanceCents()});
+        a.epoch_.store(e, memory_order_release);
+    }
+
+    void record(int id, HistoryType type, long long cents, int other = 0) noexcept {
+        if (history_) history_->append(id, type, cents, other);
+    }
+
+    // Balance changes on resolved accounts, unlogged. Locked mode: caller
+    // holds the account's stripe. Atomic mode: caller is inside the update
+    // gate and the debit CAS enforces the funds check.
+    // Both return/set the balance the change produced.
+    // A credit that would take the balance past kMaxBalanceCents is refused
+    // (Atomic mode checks inside the CAS loop, as debits do).
+    OpStatus creditHeld(Account &a, long long cents, long long &balance) noexcept {
+        beforeWrite(a);
+        long long cur = a.balanceCents_.load(memory_order_relaxed), bal;
+        if (mode_ == BalanceMode::Atomic) {
+            do {
+                if (__builtin_add_overflow(cur, cents, &bal) || bal > kMaxBalanceCents) return OpStatus::BalanceLimit;
+            } while (!a.balanceCents_.compare_exchange_weak(cur, bal, memory_order_release, memory_order_relaxed));
+        } else {
+            if (__builtin_add_overflow(cur, cents, &bal) || bal > kMaxBalanceCents) return OpStatus::BalanceLimit;
+            a.balanceCents_.store(bal, memory_order_release);
+        }
+        balance = bal;
+        return OpStatus::Ok;
+    }
+    // Debit from, then credit to; a refused credit puts the debit back.
+    // Atomic mode checks to's headroom first, so the undo (and the window
+    // where from looks debited, see BalanceMode) needs a racing credit.
+    OpStatus moveHeld(Account &from, Account &to, long long cents, long long &balance) noexcept {
+        if (long long bal; mode_ == BalanceMode::Atomic &&
+            (__builtin_add_overflow(to.balanceCents_.load(memory_order_relaxed), cents, &bal) || bal > kMaxBalanceCents))
+            return OpStatus::BalanceLimit;
+        OpStatus st = debitHeld(from, cents, balance);
+        if (st != OpStatus::Ok) return st;
+        long long toBal;
+        if ((st = creditHeld(to, cents, toBal)) != OpStatus::Ok) from.balanceCents_.fetch_add(cents, memory_order_release);
+        return st;
+    }
+    OpStatus debitHeld(Account &a, long long cents, long long &balance) noexcept {
+        beforeWrite(a);
+        long long cur = a.balanceCents_.load(memory_order_relaxed);
+        if (mode_ == BalanceMode::Atomic) {
+            do {
+                if (cents > cur) return OpStatus::InsufficientFunds;
+            } while (!a.balanceCents_.compare_exchange_weak(cur, cur - cents, memory_order_release, memory_order_relaxed));
+        } else {
+            if (cents > cur) return OpStatus::InsufficientFunds;
+            a.balanceCents_.store(cur - cents, memory_order_release);
+        }
+        balance = cur - cents;
+        return OpStatus::Ok;
+    }
+
+    // Moves cents between two resolved accounts (both stripes held, or
+    // inside the gate). In Atomic mode a concurrent reader may briefly see
+    // the money in neither account, but a checkpoint can't split the pair.
+    OpStatus transferHeld(Account &from, Account &to, long long cents, long long &balance) {
+        OpStatus st = moveHeld(from, to, cents, balance);
+        if (st != OpStatus::Ok) return st;
+        if (wal_) wal_->logTransfer(nextLsn(), from.id_, to.id_, cents);
+        record(from.id_, HistoryType::TransferOut, -cents, to.id_);
+        record(to.id_, HistoryType::TransferIn, cents, from.id_);
+        return OpStatus::Ok;
+    }
+
+    // The two halves of a cross-shard transfer (ShardedBank): an ordinary
+    // debit/credit on this shard, logged with the transfer's txid so
+    // recovery can pair it with the other shard's record.
+    OpStatus debitOut(Account &a, long long cents, uint64_t txid, int toId, long long &balance) noexcept {
+        auto run = [&] {
+            OpEpoch ep(*this);
+            OpStatus st = debitHeld(a, cents, balance);
+            if (st != OpStatus::Ok) return st;
+            if (wal_) wal_->logXfer(nextLsn(), WalOp::XferOut, a.id_, txid, toId, cents);
+            record(a.id_, HistoryType::TransferOut, -cents, toId);
+            return st;
+        };
+        if (mode_ == BalanceMode::Atomic) { UpdateGate::Scope g(gate_); return run(); }
+        lock_guard<mutex> lk(stripe(a.id_));
+        return run();
+    }
+    // Checked like any credit; a refusal (BalanceLimit) logs nothing, and
+    // ShardedBank then undoes the debit half with refundOut.
+    OpStatus creditIn(Account &a, long long cents, uint64_t txid, int fromId) noexcept {
+        auto run = [&] {
+            OpEpoch ep(*this);
+            long long bal;
+            OpStatus st = creditHeld(a, cents, bal);
+            if (st != OpStatus::Ok) return st;
+            if (wal_) wal_->logXfer(nextLsn(), WalOp::XferIn, a.id_, txid, fromId, cents);
+            record(a.id_, HistoryType::TransferIn, cents, fromId);
+            return st;
+        };
+        if (mode_ == BalanceMode::Atomic) { UpdateGate::Scope g(gate_); return run(); }
+        lock_guard<mutex> lk(stripe(a.id_));
+        return run();
+    }
+    // Compensates a debitOut whose credit was refused: puts the cents back
+    // (unchecked: they were in the account a moment ago) and logs them as
+    // an XferIn with the same txid in this shard's WAL, so recovery sees
+    // the transfer's two halves and repairs nothing.
+    void refundOut(Account &a, long long cents, uint64_t txid, int toId) noexcept {
+        auto run = [&] {
+            OpEpoch ep(*this);
+            beforeWrite(a);
+            a.balanceCents_.fetch_add(cents, memory_order_release);
+            if (wal_) wal_->logXfer(nextLsn(), WalOp::XferIn, a.id_, txid, toId, cents);
+            record(a.id_, HistoryType::TransferIn, cents, toId);
+        };
+        if (mode_ == BalanceMode::Atomic) { UpdateGate::Scope g(gate_); run(); return; }
+        lock_guard<mutex> lk(stripe(a.id_));
+        run();
+    }
+    // Recovery: applies (and, once a WAL is attached, logs) a half whose
+    // partner survived in another shard's log. Bank not yet shared.
+    void applyHalf(const XferHalf &h) {
+        Account *a = findById(h.id);
+        if (!a) return;
+        a->balanceCents_.fetch_add(h.out ? -h.cents : h.cents, memory_order_relaxed);
+    }
+    void logHalf(const XferHalf &h) { if (wal_) wal_->logXfer(nextLsn(), h.out ? WalOp::XferOut : WalOp::XferIn, h.id, h.txid, h.other, h.cents); }
+
+    void lockAll() const {
+        writeMu_.lock();
+        for (size_t i = 0; i < kStripes; ++i) stripes_[i].m.lock();
+        gate_.close();
+    }
+    void unlockAll() const {
+        gate_.open();
+        for (size_t i = kStripes; i-- > 0;) stripes_[i].m.unlock();
+        writeMu_.unlock();
+    }
+
+    uint64_t nextLsn() { return lsn_.fetch_add(1, memory_order_relaxed) + 1; }
+
+    Account* materialize(const SnapRecord &r) {
+        lock_guard<mutex> lk(writeMu_);
+        int slot = index_.find(r.id); // another thread may have beaten us to it
+        if (slot != AccountIndex::npos) return &accounts_[slot];
+        uint32_t owner = ownerNames().intern(snap_->owner(r));
+        Account &a = accounts_.emplace_back(r.id, owner, r.balanceCents, (size_t)r.salt, (size_t)r.pinHash, r.pinCost);
+        index_.insert(r.id, (int)accounts_.size() - 1);
+        snapShadowed_.fetch_add(1, memory_order_relaxed);
+        return &a;
+    }
+
+    // Not thread-safe; only for load/recovery before the bank is shared.
+    void reset() {
+        accounts_.clear(); index_.clear(); snap_.reset(); snapShadowed_ = 0; nextId_ = firstId_; lsn_ = 0; baseLsn_ = 0;
+        owners_.clear(); ownersReady_ = false;
+    }
+
+    // Caller holds writeMu_ (or owns the bank).
+    void indexOwner(uint32_t owner, int id) {
+        unique_lock<shared_mutex> lk(ownerMu_);
+        if (ownersReady_) owners_.insert(owner, id);
+    }
+
+    // Bulk (re)build from every account. Caller holds writeMu_ (or owns the
+    // bank) and ownerMu_ exclusively. Reads only IDs and owners, which never
+    // change, so concurrent balance updates don't matter.
+    void rebuildOwnersLocked() const {
+        vector<OwnerIndex::Entry> all;
+        all.reserve(size());
+        const size_t bound = accounts_.size();
+        if (snap_) {
+            for (size_t i = 0; i < snap_->size(); ++i) {
+                const SnapRecord &r = (*snap_)[i];
+                int slot = snapShadowed_.load(memory_order_relaxed) ? index_.find(r.id) : AccountIndex::npos;
+                if (slot != AccountIndex::npos && (size_t)slot < bound) continue;
+                all.push_back({ownerNames().intern(snap_->owner(r)), r.id});
+            }
+        }
+        for (size_t i = 0; i < bound; ++i) all.push_back({accounts_[i].owner_, accounts_[i].id_});
+        owners_.build(std::move(all));
+        ownersReady_ = true;
+    }
+
+    // Re-applies a logged mutation (recovery, before the bank is shared). The
+    // original call already validated it, so balances/hashes are set
+    // directly. LSNs from different accounts may interleave slightly out of
+    // order in the file, so skip by the snapshot's LSN, not the running max.
+    void applyLogged(const WalEntry &e) {
+        if (e.op == WalOp::XferOut || e.op == WalOp::XferIn)
+            xferHalves_.push_back({e.txid, e.id, e.toId, e.cents, e.op == WalOp::XferOut, e.lsn <= baseLsn_});
+        if (e.lsn <= baseLsn_) return; // already in the snapshot
+        if (e.lsn > lsn_) lsn_ = e.lsn;
+        if (e.op == WalOp::Batch) {
+            for (size_t k = 0; k < e.items.size(); k += kBatchItem) {
+                const char *p = e.items.data() + k;
+                WalEntry item{};
+                item.lsn = e.lsn; item.op = (WalOp)p[0];
+                memcpy(&item.id, p + 1, 4); memcpy(&item.toId, p + 5, 4); memcpy(&item.cents, p + 9, 8);
+                if (item.op == WalOp::Deposit || item.op == WalOp::Withdraw || item.op == WalOp::Transfer) applyLogged(item);
+            }
+            return;
+        }
+        if (e.op == WalOp::Create) {
+            if (findById(e.id)) return;
+            accounts_.emplace_back(e.id, ownerNames().intern(e.owner), 0LL, (size_t)e.salt, (size_t)e.pinHash, e.pinCost);
+            index_.insert(e.id, (int)accounts_.size() - 1);
+            indexOwner(accounts_[accounts_.size() - 1].owner_, e.id);
+            nextId_ = max(nextId_, e.id + 1);
+            return;
+        }
+        Account *a = findById(e.id);
+        if (!a) return;
+        if (e.op == WalOp::Transfer) {
+            Account *b = findById(e.toId);
+            if (!b) return;
+            a->balanceCents_.fetch_sub(e.cents, memory_order_relaxed);
+            b->balanceCents_.fetch_add(e.cents, memory_order_relaxed);
+            return;
+        }
+        if (e.op == WalOp::Deposit || e.op == WalOp::XferIn) a->balanceCents_.fetch_add(e.cents, memory_order_relaxed);
+        else if (e.op == WalOp::Withdraw || e.op == WalOp::XferOut) a->balanceCents_.fetch_sub(e.cents, memory_order_relaxed);
+        else if (e.op == WalOp::SetPin) { a->pinHash_ = (size_t)e.pinHash; a->pinCost_ = e.pinCost; }
+    }
+public:
+    // IDs are handed out from firstId up to (not including) endId;
+    // ShardedBank gives each shard its own range.
+    explicit Bank(BalanceMode mode = BalanceMode::Locked, int firstId = 1001, int endId = INT_MAX)
+        : mode_(mode), firstId_(firstId), endId_(endId), nextId_(firstId) {}
+    Bank(const Bank &) = delete;
+    Bank& operator=(const Bank &) = delete;
+    ~Bank() { pollCheckpoint(true); }
+
+    // Read-only view of one account, wherever it currently lives.
+    struct AccountView { int id; string_view owner; long long balanceCents; size_t salt, pinHash; unsigned pinCost; };
+
+    struct NewAccount { string owner, pin; };
+
+    // Bulk onboarding: every PIN is checked before anything is created, salts
+    // and hashes are computed outside the lock, then the whole block of
+    // consecutive IDs is assigned, logged and published under one writeMu_
+    // acquisition. Returns the new IDs in input order.
+    vector<int> createAccounts(const NewAccount *items, size_t n) {
+        vector<pair<size_t, size_t>> keys(n); // (salt, pinHash)
+        vector<uint32_t> owners(n);
+        for (size_t i = 0; i < n; ++i) {
+            if (!validPin(items[i].pin)) throw invalid_argument("PIN must be 4-12 digits");
+            if (items[i].owner.size() > kMaxOwnerBytes) throw invalid_argument("Owner name too long");
+        }
+        const unsigned cost = g_pinCost.load(memory_order_relaxed);
+        for (size_t i = 0; i < n; ++i) {
+            owners[i] = ownerNames().intern(items[i].owner);
+            keys[i].first = makeSalt();
+            keys[i].second = hashPin(items[i].pin, keys[i].first, cost);
+        }
+        vector<int> ids(n);
+        lock_guard<mutex> lk(writeMu_);
+        if ((long long)nextId_ + (long long)n > endId_) throw length_error("account ID range exhausted");
+        index_.reserve(n, nextId_);
+        for (size_t i = 0; i < n; ++i) {
+            int id = ids[i] = nextId_++;
+            if (wal_) wal_->logCreate(nextLsn(), id, items[i].owner, keys[i].first, keys[i].second, (uint8_t)cost);
+            accounts_.emplace_back(id, owners[i], 0LL, keys[i].first, keys[i].second, cost);
+            index_.insert(id, (int)accounts_.size() - 1);
+        }
+        unique_lock<shared_mutex> ol(ownerMu_);
+        if (ownersReady_) {
+            vector<OwnerIndex::Entry> add(n);
+            for (size_t i = 0; i < n; ++i) add[i] = {owners[i], ids[i]};
+            owners_.insertMany(std::move(add));
+        }
+        return ids;
+    }
+    vector<int> createAccounts(const vector<NewAccount> &items) { return createAccounts(items.data(), items.size()); }
+
+    int createAccount(const string &owner, const string &pin) {
+        // Salt + hash outside the lock; only ID assignment is serialized.
+        if (!validPin(pin)) throw invalid_argument("PIN must be 4-12 digits");
+        if (owner.size() > kMaxOwnerBytes) throw invalid_argument("Owner name too long");
+        const unsigned cost = g_pinCost.load(memory_order_relaxed);
+        size_t salt = makeSalt(), hash = hashPin(pin, salt, cost);
+        uint32_t ownerId = ownerNames().intern(owner);
+        lock_guard<mutex> lk(writeMu_);
+        if (nextId_ >= endId_) throw length_error("account ID range exhausted");
+        int id = nextId_++;
+        // Log before publishing, so no later op on this ID precedes it in the WAL.
+        if (wal_) wal_->logCreate(nextLsn(), id, owner, salt, hash, (uint8_t)cost);
+        accounts_.emplace_back(id, ownerId, 0LL, salt, hash, cost);
+        index_.insert(id, (int)accounts_.size() - 1);
+        indexOwner(ownerId, id);
+        return id;
+    }
+
+    // Mutations go through Bank (not Account directly) so they are locked
+    // and logged. deposit/withdraw return the new balance. LSNs are only
+    // handed out while a WAL is attached, so an unlogged bank has no shared
+    // counter on the hot path.
+    // Exception-free forms: on Ok, balance is the account's new balance.
+    // In Atomic mode the log order of concurrent deposits/withdrawals on one
+    // account may differ from the order they hit the balance; replay only
+    // sums deltas, so the recovered balance is the same.
+    OpStatus tryDeposit(Account &a, long long cents, long long &balance) noexcept {
+        StatTimer t(StatOp::Deposit);
+        if (cents <= 0) return OpStatus::InvalidAmount;
+        if (mode_ == BalanceMode::Atomic) {
+            UpdateGate::Scope g(gate_);
+            OpEpoch ep(*this);
+            if (OpStatus st = creditHeld(a, cents, balance); st != OpStatus::Ok) return st;
+            if (wal_) wal_->logAmount(nextLsn(), WalOp::Deposit, a.id_, cents);
+            record(a.id_, HistoryType::Deposit, cents);
+            return OpStatus::Ok;
+        }
+        lock_guard<mutex> lk(stripe(a.id_));
+        OpEpoch ep(*this);
+        if (OpStatus st = creditHeld(a, cents, balance); st != OpStatus::Ok) return st;
+        if (wal_) wal_->logAmount(nextLsn(), WalOp::Deposit, a.id_, cents);
+        record(a.id_, HistoryType::Deposit, cents);
+        return OpStatus::Ok;
+    }
+
+    OpStatus tryWithdraw(Account &a, long long cents, long long &balance) noexcept {
+        StatTimer t(StatOp::Withdraw);
+        if (cents <= 0) return OpStatus::InvalidAmount;
+        OpStatus st;
+        if (mode_ == BalanceMode::Atomic) {
+            UpdateGate::Scope g(gate_);
+            OpEpoch ep(*this);
+            st = debitHeld(a, cents, balance);
+            if (st == OpStatus::Ok) {
+                if (wal_) wal_->logAmount(nextLsn(), WalOp::Withdraw, a.id_, cents);
+                record(a.id_, HistoryType::Withdraw, -cents);
+            }
+            return countDecline(st);
+        }
+        lock_guard<mutex> lk(stripe(a.id_));
+        OpEpoch ep(*this);
+        st = debitHeld(a, cents, balance);
+        if (st == OpStatus::Ok) {
+            if (wal_) wal_->logAmount(nextLsn(), WalOp::Withdraw, a.id_, cents);
+            record(a.id_, HistoryType::Withdraw, -cents);
+        }
+        return countDecline(st);
+    }
+
+    // Atomic: either both balances change or neither. Deadlock-free: the two
+    // stripes are always locked in stripe-index order. balance is the source
+    // account's new balance.
+    OpStatus tryTransfer(Account &from, Account &to, long long cents, long long &balance) noexcept {
+        StatTimer t(StatOp::Transfer);
+        if (&from == &to) return OpStatus::SameAccount;
+        if (cents <= 0) return OpStatus::InvalidAmount;
+        if (mode_ == BalanceMode::Atomic) {
+            UpdateGate::Scope g(gate_);
+            OpEpoch ep(*this);
+            return countDecline(transferHeld(from, to, cents, balance));
+        }
+        size_t a = stripeOf(from.id_), b = stripeOf(to.id_);
+        lock_guard<mutex> first(stripes_[min(a, b)].m);
+        unique_lock<mutex> second;
+        if (a != b) second = unique_lock<mutex>(stripes_[max(a, b)].m);
+        OpEpoch ep(*this);
+        return countDecline(transferHeld(from, to, cents, balance));
+    }
+
+    OpStatus trySetPin(Account &a, const string &pin) noexcept {
+        if (!validPin(pin)) return OpStatus::InvalidPin;
+        const unsigned cost = g_pinCost.load(memory_order_relaxed);
+        size_t hash = hashPin(pin, a.salt_, cost); // outside the lock; salt_ never changes
+        lock_guard<mutex> lk(stripe(a.id_));
+        a.pinHash_ = hash;
+        a.pinCost_ = (uint8_t)cost;
+        if (wal_) wal_->logSetPin(nextLsn(), a.id_, hash, (uint8_t)cost); // also ends a's sessions (see SessionCache)
+        return OpStatus::Ok;
+    }
+
+    // A deposit made in currency C, credited at rate (rounded to the cent).
+    template <class C> OpStatus tryDepositIn(Account &a, Money<C> amount, FxRate<C, BookCurrency> rate, long long &balance) noexcept {
+        BookMoney book;
+        if (!rate.tryConvert(amount, book)) return OpStatus::BalanceLimit;
+        return tryDeposit(a, book.minor(), balance);
+    }
+
+    // Throwing forms; each returns the new balance.
+    long long deposit(Account &a, long long cents) {
+        long long bal = 0;
+        if (OpStatus s = tryDeposit(a, cents, bal); s != OpStatus::Ok) throwOpStatus(s, "Deposit must be positive");
+        return bal;
+    }
+    long long withdraw(Account &a, long long cents) {
+        long long bal = 0;
+        if (OpStatus s = tryWithdraw(a, cents, bal); s != OpStatus::Ok) throwOpStatus(s, "Withdrawal must be positive");
+        return bal;
+    }
+    long long transfer(Account &from, Account &to, long long cents) {
+        long long bal = 0;
+        if (OpStatus s = tryTransfer(from, to, cents, bal); s != OpStatus::Ok) throwOpStatus(s, "Transfer must be positive");
+        return bal;
+    }
+    void setPin(Account &a, const string &pin) { if (OpStatus s = trySetPin(a, pin); s != OpStatus::Ok) throwOpStatus(s); }
+
+    // Applies ops in submission order and returns one status per op instead
+    // of throwing. Accounts are resolved once up front (the dense index makes
+    // that a probe, cheaper than sorting the batch), their stripes collected
+    // in a bitmap, and each touched stripe locked once, in index order, for
+    // the whole batch. Successful ops go to the WAL as a single Batch record
+    // while the locks are held. Large batches hold their stripes for longer;
+    // see transferMany.
+    vector<OpStatus> applyBatch(const BatchOp *ops, size_t n) {
+        vector<OpStatus> out(n);
+        vector<Account *> acc(2 * n, nullptr);
+        uint64_t touched[kStripes / 64] = {};
+        auto resolve = [&](int id) {
+            Account *a = findById(id);
+            if (a) touched[stripeOf(id) / 64] |= 1ull << (stripeOf(id) % 64);
+            return a;
+        };
+        for (size_t i = 0; i < n; ++i) {
+            const BatchOp &o = ops[i];
+            bool xfer = o.kind == BatchOp::Kind::Transfer;
+            acc[2 * i] = resolve(o.id);
+            if (xfer) acc[2 * i + 1] = resolve(o.toId);
+            out[i] = !acc[2 * i] || (xfer && !acc[2 * i + 1]) ? OpStatus::NoSuchAccount
+                   : xfer && o.id == o.toId ? OpStatus::SameAccount
+                   : o.cents <= 0 ? OpStatus::InvalidAmount : OpStatus::Ok;
+        }
+        auto eachStripe = [&](auto &&f) {
+            for (size_t w = 0; w < kStripes / 64; ++w)
+                for (uint64_t bits = touched[w]; bits; bits &= bits - 1) f(w * 64 + (size_t)__builtin_ctzll(bits));
+        };
+        string log;
+        auto run = [&] {
+            OpEpoch ep(*this);
+            int32_t logged = 0;
+            long long bal;
+            for (size_t i = 0; i < n; ++i) {
+                if (out[i] != OpStatus::Ok) continue;
+                const BatchOp &o = ops[i];
+                WalOp op = WalOp::Deposit;
+                switch (o.kind) {
+                    case BatchOp::Kind::Deposit:
+                        out[i] = creditHeld(*acc[2 * i], o.cents, bal);
+                        if (out[i] == OpStatus::Ok) record(o.id, HistoryType::Deposit, o.cents);
+                        break;
+                    case BatchOp::Kind::Withdraw:
+                        out[i] = debitHeld(*acc[2 * i], o.cents, bal); op = WalOp::Withdraw;
+                        if (out[i] == OpStatus::Ok) record(o.id, HistoryType::Withdraw, -o.cents);
+                        break;
+                    case BatchOp::Kind::Transfer:
+                        out[i] = moveHeld(*acc[2 * i], *acc[2 * i + 1], o.cents, bal); op = WalOp::Transfer;
+                        if (out[i] != OpStatus::Ok) break;
+                        record(o.id, HistoryType::TransferOut, -o.cents, o.toId);
+                        record(o.toId, HistoryType::TransferIn, o.cents, o.id);
+                        break;
+                }
+                if (!wal_ || out[i] != OpStatus::Ok) continue;
+                char item[kBatchItem];
+                item[0] = (char)op; memcpy(item + 1, &o.id, 4); memcpy(item + 5, &o.toId, 4);
+                int64_t c = o.cents; memcpy(item + 9, &c, 8);
+                log.append(item, kBatchItem); ++logged;
+            }
+            if (logged) wal_->logBatch(nextLsn(), logged, log);
+        };
+        if (mode_ == BalanceMode::Atomic) { UpdateGate::Scope g(gate_); run(); return out; }
+        eachStripe([&](size_t l) { stripes_[l].m.lock(); });
+        run();
+        eachStripe([&](size_t l) { stripes_[l].m.unlock(); });
+        return out;
+    }
+    vector<OpStatus> applyBatch(const vector<BatchOp> &ops) { return applyBatch(ops.data(), ops.size()); }
+
+    // Transfers in submission order, one status per item. Runs applyBatch
+    // over windows of kWindow items so no caller holds many stripes for
+    // long; each window is one WAL record.
+    vector<OpStatus> transferMany(const vector<TransferRequest> &batch) {
+        constexpr size_t kWindow = 64;
+        vector<OpStatus> out; out.reserve(batch.size());
+        vector<BatchOp> ops;
+        for (size_t base = 0; base < batch.size(); base += kWindow) {
+            ops.clear();
+            for (size_t i = base; i < min(batch.size(), base + kWindow); ++i)
+                ops.push_back({BatchOp::Kind::Transfer, batch[i].from, batch[i].cents, batch[i].to});
+            vector<OpStatus> r = applyBatch(ops);
+            out.insert(out.end(), r.begin(), r.end());
+        }
+        return out;
+    }
+
+
+    // Interest/fees on every account (see AccrualRule), on `threads` workers
+    // (0: one per core). Accounts are bucketed by stripe group (kAccrualGroups
+    // runs of adjacent stripes) and cut into chunks of up to kAccrualChunk.
+    // A worker claims a chunk, takes only its group's stripes (Atomic mode:
+    // the gate, and a CAS per account), updates it and writes one Batch WAL
+    // record, so deposits elsewhere keep going and a checkpoint never splits
+    // a chunk. Not all-or-nothing: a crash mid-pass leaves whole chunks
+    // applied (and logged), and running the pass again charges them twice.
+    AccrualResult accrue(const AccrualRule &rule, unsigned threads = 0) {
+        if (rule.rateE8 < -kAccrualRateMax || rule.rateE8 > kAccrualRateMax) throw invalid_argument("accrual rate out of range");
+        constexpr size_t kAccrualGroups = 64, kGroupStripes = kStripes / kAccrualGroups, kAccrualChunk = 16384;
+        {
+            long long next; bool capped;
+            if (snap_) // copy in the snapshot accounts the pass changes (materialize takes writeMu_: before any stripe)
+                for (size_t i = 0; i < snap_->size(); ++i)
+                    if (accrualNext(rule, (*snap_)[i].balanceCents, next, capped) && index_.find((*snap_)[i].id) == AccountIndex::npos) materialize((*snap_)[i]);
+        }
+        // Counting sort of arena slots by stripe group.
+        const size_t n = accounts_.size();
+        vector<uint32_t> slots(n);
+        array<size_t, kAccrualGroups + 1> start{};
+        for (size_t i = 0; i < n; ++i) ++start[stripeOf(accounts_[i].id_) / kGroupStripes + 1];
+        for (size_t g = 0; g < kAccrualGroups; ++g) start[g + 1] += start[g];
+        array<size_t, kAccrualGroups> fill;
+        copy(start.begin(), start.end() - 1, fill.begin());
+        for (size_t i = 0; i < n; ++i) slots[fill[stripeOf(accounts_[i].id_) / kGroupStripes]++] = (uint32_t)i;
+        struct Chunk { size_t group, begin, end; };
+        vector<Chunk> chunks;
+        for (size_t g = 0; g < kAccrualGroups; ++g)
+            for (size_t b = start[g]; b < start[g + 1]; b += kAccrualChunk) chunks.push_back({g, b, min(start[g + 1], b + kAccrualChunk)});
+
+        mutex resultMu;
+        AccrualResult total;
+        total.chunks = chunks.size();
+        atomic<size_t> nextChunk{0};
+        auto work = [&] {
+            AccrualResult mine;
+            string log;
+            for (size_t c; (c = nextChunk.fetch_add(1, memory_order_relaxed)) < chunks.size();) {
+                const Chunk &ch = chunks[c];
+                auto run = [&] {
+                    OpEpoch ep(*this);
+                    log.clear();
+                    int32_t logged = 0;
+                    for (size_t k = ch.begin; k < ch.end; ++k) {
+                        Account &a = accounts_[slots[k]];
+                        beforeWrite(a);
+                        long long cur = a.balanceCents_.load(memory_order_relaxed), next;
+                        bool capped;
+                        if (mode_ == BalanceMode::Atomic) {
+                            bool change;
+                            while ((change = accrualNext(rule, cur, next, capped)) && !a.balanceCents_.compare_exchange_weak(cur, next, memory_order_release, memory_order_relaxed)) {}
+                            mine.capped += capped;
+                            if (!change) continue;
+                        } else {
+                            bool change = accrualNext(rule, cur, next, capped);
+                            mine.capped += capped;
+                            if (!change) continue;
+                            a.balanceCents_.store(next, memory_order_release);
+                        }
+                        long long delta = next - cur;
+                        ++mine.accounts;
+                        (delta > 0 ? mine.creditedCents : mine.debitedCents) += llabs(delta);
+                        record(a.id_, HistoryType::Accrual, delta);
+                        if (!wal_) continue;
+                        char item[kBatchItem];
+                        item[0] = (char)(delta > 0 ? WalOp::Deposit : WalOp::Withdraw);
+                        int32_t none = 0; int64_t cents = llabs(delta);
+                        memcpy(item + 1, &a.id_, 4); memcpy(item + 5, &none, 4); memcpy(item + 9, &cents, 8);
+                        log.append(item, kBatchItem); ++logged;
+                    }
+                    if (logged) wal_->logBatch(nextLsn(), logged, log);
+                };
+                if (mode_ == BalanceMode::Atomic) { UpdateGate::Scope g(gate_); run(); continue; }
+                for (size_t l = 0; l < kGroupStripes; ++l) stripes_[ch.group * kGroupStripes + l].m.lock();
+                run();
+                for (size_t l = kGroupStripes; l-- > 0;) stripes_[ch.group * kGroupStripes + l].m.unlock();
+            }
+            lock_guard<mutex> lk(resultMu);
+            total.accounts += mine.accounts; total.capped += mine.capped;
+            total.creditedCents += mine.creditedCents; total.debitedCents += mine.debitedCents;
+        };
+        if (!threads) threads = max(1u, thread::hardware_concurrency());
+        threads = (unsigned)min<size_t>(threads, chunks.size());
+        vector<thread> pool;
+        for (unsigned t = 1; t < threads; ++t) pool.emplace_back(work);
+        work();
+        for (auto &th : pool) th.join();
+        return total;
+    }
+
+    // The balance is atomic, so reads never need the stripe.
+    long long balanceCents(const Account &a) const { return a.balanceCents(); }
+    BalanceMode balanceMode() const { return mode_; }
+
+    // ---- durability ----
+    // Startup: newest base (snapshot, else TSV) + replay of the WAL tail.
+    // The log may be split in two: walPath.ckpt holds records a background
+    // checkpoint was capturing when we stopped, walPath the newer ones.
+    bool recover(const string &snapPath, const string &tsvPath, const string &walPath) {
+        xferHalves_.clear();
+        if (!openSnapshot(snapPath)) loadFromFile(tsvPath);
+        auto apply = [&](const WalEntry &e) { applyLogged(e); };
+        bool ok = WriteAheadLog::replay(walPath + ".ckpt", apply);
+        ok = WriteAheadLog::replay(walPath, apply) && ok;
+        ckptBase_ = lsn_.load();
+        return ok;
+    }
+
+    // Starts logging every mutation to path. Call after recover().
+    bool attachWal(const string &path, WalOptions opt = {}) {
+        auto wal = make_unique<WriteAheadLog>();
+        if (!wal->open(path, opt)) return false;
+        wal_ = std::move(wal);
+        walPath_ = path;
+        return true;
+    }
+
+    void syncWal() { if (wal_) wal_->sync(); }
+
+    // Writes snapshot + TSV, then drops the log records they now contain.
+    // Synchronous (used on exit); waits for any background checkpoint first.
+    bool checkpoint(const string &snapPath, const string &tsvPath) {
+        StatTimer t(StatOp::Save);
+        pollCheckpoint(true);
+        lock_guard<mutex> ck(ckptMu_);
+        lockAll();
+        if (wal_) wal_->sync();
+        bool ok = writeSnapshot(snapPath) && writeTsv(tsvPath) && dropLoggedLocked();
+        unlockAll();
+        return ok;
+    }
+private:
+    // After a synchronous checkpoint wrote everything logged so far; caller holds lockAll().
+    bool dropLoggedLocked() {
+        if (!walPath_.empty()) std::remove((walPath_ + ".ckpt").c_str());
+        ckptBase_ = lsn_.load();
+        return !wal_ || wal_->truncate();
+    }
+public:
+
+    // Background checkpoint. The WAL is rotated to walPath.ckpt, then the
+    // process fork()s: the child writes snapshot + TSV from its copy-on-write
+    // image of the bank (consistent as of lsn_) and exits, while the parent
+    // keeps serving requests and pays only for the rotate + fork. Once
+    // pollCheckpoint() reaps a successful child, the rotated segment is
+    // deleted, which is the log truncation.
+    // All locks are held across rotate + fork so the image is a clean cut.
+    bool beginCheckpoint(const string &snapPath, const string &tsvPath) {
+        lock_guard<mutex> ck(ckptMu_);
+        if (ckptPid_ > 0) return false;
+        auto t0 = chrono::steady_clock::now();
+        lockAll();
+        if (wal_ && !wal_->rotate(walPath_ + ".ckpt")) { unlockAll(); return false; }
+        pid_t pid = fork();
+        if (pid == 0) {
+            // Only this thread exists in the child and the locks are frozen
+            // held, so write with the unlocked helpers.
+            bool ok = writeSnapshot(snapPath) && writeTsv(tsvPath);
+            _exit(ok ? 0 : 1);     // no destructors: the WAL/flusher belong to the parent
+        }
+        unlockAll();
+        if (pid < 0) return false; // the rotated segment is folded into the next attempt
+        ckptPid_ = pid; ckptLsn_ = lsn_; ckptBase_ = ckptLsn_; ckptStart_ = t0;
+        ++ckptStats_.started;
+        ckptStats_.lastForkPauseUs = chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count();
+        return true;
+    }
+
+    // Reaps a finished background checkpoint (wait: block until it is done).
+    // Returns true if one completed successfully during this call.
+    bool pollCheckpoint(bool wait = false) {
+        lock_guard<mutex> ck(ckptMu_);
+        if (ckptPid_ <= 0) return false;
+        int status = 0;
+        pid_t r;
+        do r = waitpid(ckptPid_, &status, wait ? 0 : WNOHANG); while (r < 0 && errno == EINTR);
+        if (r == 0) return false;
+        ckptPid_ = -1;
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - ckptStart_).count();
+        ckptStats_.lastDurationMs = ms;
+        ckptStats_.maxDurationMs = max(ckptStats_.maxDurationMs, ms);
+        bool ok = r > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (!ok) { ++ckptStats_.failed; return false; }
+        if (!walPath_.empty()) std::remove((walPath_ + ".ckpt").c_str());
+        ++ckptStats_.completed;
+        ckptStats_.lastLsn = ckptLsn_;
+        return true;
+    }
+
+    bool checkpointRunning() { lock_guard<mutex> ck(ckptMu_); return ckptPid_ > 0; }
+    uint64_t walRecordsSinceCheckpoint() const { return lsn_ - ckptBase_; }
+    const CheckpointStats& checkpointStats() const { return ckptStats_; }
+
+    // Have maybeCheckpoint() start a background checkpoint every `every`
+    // logged mutations (0 disables).
+    void enableAutoCheckpoint(const string &snapPath, const string &tsvPath, uint64_t every) {
+        autoSnap_ = snapPath; autoTsv_ = tsvPath; autoEvery_ = every;
+    }
+
+    // Cheap; call from the request loop.
+    void maybeCheckpoint() {
+        pollCheckpoint();
+        if (autoEvery_ && walRecordsSinceCheckpoint() >= autoEvery_ && !checkpointRunning()) beginCheckpoint(autoSnap_, autoTsv_);
+    }
+
+    Account* findById(int id) {
+        int slot = index_.find(id);
+        if (slot != AccountIndex::npos) return &accounts_[slot];
+        if (snap_) if (const SnapRecord *r = snap_->find(id)) return materialize(*r);
+        return nullptr;
+    }
+
+private:
+    // After a login verified pin against hash, re-hashes it at the current
+    // cost if it was made cheaper (or with the legacy scheme), unless the
+    // PIN changed meanwhile.
+    void upgradePin(Account &a, const string &pin, size_t verified, unsigned cost) {
+        const unsigned want = g_pinCost.load(memory_order_relaxed);
+        if (cost >= want) return;
+        size_t hash = hashPin(pin, a.salt_, want);
+        lock_guard<mutex> lk(stripe(a.id_));
+        if (a.pinHash_ != verified) return;
+        a.pinHash_ = hash; a.pinCost_ = (uint8_t)want;
+        if (wal_) wal_->logSetPin(nextLsn(), a.id_, hash, (uint8_t)want);
+    }
+public:
+    // The KDF runs without the stripe held, so a slow hash never stalls
+    // deposits to accounts sharing the stripe.
+    // A wrong PIN for an existing account counts as a BadPin decline.
+    Account* login(int id, const string &pin) {
+        StatTimer t(StatOp::Login);
+        int slot = index_.find(id);
+        if (slot == AccountIndex::npos && snap_) {
+            // Check the PIN against the mapping first so failed logins copy nothing.
+            const SnapRecord *r = snap_->find(id);
+            if (!r) return nullptr;
+            if (hashPin(pin, (size_t)r->salt, r->pinCost) != (size_t)r->pinHash) { statCount(StatCounter::BadPin); return nullptr; }
+            Account *a = materialize(*r);
+            upgradePin(*a, pin, (size_t)r->pinHash, r->pinCost);
+            return a;
+        }
+        Account* acc = findById(id);
+        if (!acc) return nullptr;
+        size_t hash; unsigned cost;
+        { lock_guard<mutex> lk(stripe(id)); hash = acc->pinHash_; cost = acc->pinCost_; }
+        if (hashPin(pin, acc->salt_, cost) != hash) { statCount(StatCounter::BadPin); return nullptr; }
+        upgradePin(*acc, pin, hash, cost);
+        return acc;
+    }
+
+    // Session API: openSession pays the KDF once and returns a token (0 on
+    // a bad ID/PIN); resume then re-authenticates with a hash-map lookup
+    // until the session expires, is evicted, is closed, or the PIN changes.
+    uint64_t openSession(int id, const string &pin) {
+        Account *a = login(id, pin);
+        if (!a) return 0;
+        lock_guard<mutex> lk(stripe(id));
+        return sessions_.issue(id, a->pinHash_);
+    }
+    Account* resume(int id, uint64_t token) {
+        Account *a = findById(id);
+        if (!a) return nullptr;
+        size_t hash;
+        { lock_guard<mutex> lk(stripe(id)); hash = a->pinHash_; }
+        return sessions_.check(token, id, hash) ? a : nullptr;
+    }
+    void closeSession(uint64_t token) { sessions_.end(token); }
+    void configureSessions(size_t capacity, chrono::milliseconds ttl) { sessions_.configure(capacity, ttl); }
+
+    // Owner search, ordered by (owner, id). Prefix queries are O(log n + k).
+    vector<OwnerMatch> findByOwner(string_view owner, size_t limit = SIZE_MAX) const { return ownerQuery(owner, true, limit); }
+    vector<OwnerMatch> searchOwnerPrefix(string_view prefix, size_t limit = 100) const { return ownerQuery(prefix, false, limit); }
+private:
+    vector<OwnerMatch> ownerQuery(string_view key, bool exact, size_t limit) const {
+        {
+            shared_lock<shared_mutex> lk(ownerMu_);
+            if (ownersReady_) return owners_.find(key, exact, limit);
+        }
+        lock_guard<mutex> w(writeMu_);
+        unique_lock<shared_mutex> lk(ownerMu_);
+        if (!ownersReady_) rebuildOwnersLocked();
+        return owners_.find(key, exact, limit);
+    }
+public:
+
+private:
+    int nextIdSnapshot() const { lock_guard<mutex> lk(writeMu_); return nextId_; }
+    // id's live balance and owner, wherever the account lives; no copy.
+    bool rowOf(int id, long long &cents, string_view &owner) const {
+        int slot = index_.find(id);
+        if (slot != AccountIndex::npos) { cents = accounts_[slot].balanceCents(); owner = accounts_[slot].owner(); return true; }
+        if (snap_) if (const SnapRecord *r = snap_->find(id)) { cents = r->balanceCents; owner = snap_->owner(*r); return true; }
+        return false;
+    }
+public:
+
+    // Balance lookup that never copies out of the snapshot.
+    bool balanceOf(int id, long long &cents) const {
+        int slot = index_.find(id);
+        if (slot != AccountIndex::npos) { cents = accounts_[slot].balanceCents(); return true; }
+        if (snap_) if (const SnapRecord *r = snap_->find(id)) { cents = r->balanceCents; return true; }
+        return false;
+    }
+
+    // FX batch for reporting in another currency: out[i] is ids[i]'s balance
+    // at one rate (zero for a missing account). False if any conversion
+    // overflowed; out is filled up to that one.
+    template <class C> bool balancesIn(const int *ids, size_t n, FxRate<BookCurrency, C> rate, Money<C> *out) const {
+        vector<BookMoney> book(n);
+        for (size_t i = 0; i < n; ++i) { long long c = 0; balanceOf(ids[i], c); book[i] = BookMoney::fromMinor(c); }
+        return fxConvert(book.data(), n, rate, out) == n;
+    }
+
+private:
+    // Visits every account once: untouched snapshot records first (in ID
+    // order), then accounts_. Lockless; the caller holds lockAll() or owns
+    // the bank exclusively.
+    template <class F> void forEachAccountUnlocked(F &&f) const { forEachAccountImpl(f, false); }
+
+    template <class F> void forEachAccountImpl(F &f, bool lockRows) const {
+        // Bound the arena first: a record copied in after this point is
+        // still visited through its snapshot copy and not again after.
+        const size_t bound = accounts_.size();
+        if (snap_) {
+            for (size_t i = 0; i < snap_->size(); ++i) {
+                const SnapRecord &r = (*snap_)[i];
+                if (snapShadowed_.load(memory_order_relaxed)) {
+                    int slot = index_.find(r.id);
+                    if (slot != AccountIndex::npos && (size_t)slot < bound) continue;
+                }
+                f(AccountView{r.id, snap_->owner(r), r.balanceCents, (size_t)r.salt, (size_t)r.pinHash, r.pinCost});
+            }
+        }
+        for (size_t i = 0; i < bound; ++i) {
+            const Account &a = accounts_[i];
+            if (!lockRows) { f(AccountView{a.id_, a.owner(), a.balanceCents(), a.salt_, a.pinHash_, a.pinCost_}); continue; }
+            unique_lock<mutex> lk(stripe(a.id_)); // for pinHash_; the balance is atomic
+            AccountView v{a.id_, a.owner(), a.balanceCents(), a.salt_, a.pinHash_, a.pinCost_};
+            lk.unlock();
+            f(v);
+        }
+    }
+
+    bool writeSnapshot(const string &path) const {
+        vector<SnapRecord> recs; recs.reserve(size());
+        string heap;
+        forEachAccountUnlocked([&](const AccountView &a) {
+            recs.push_back(SnapRecord{a.id, (uint32_t)a.owner.size(), heap.size(), a.balanceCents, a.salt, a.pinHash, a.pinCost, 0});
+            heap += a.owner;
+        });
+        return SnapshotFile::write(path, recs, heap, nextId_, lsn_);
+    }
+
+    // TSV, one account per line: id, owner, balanceCents, salt, pinHash,
+    // pinCost (files from before the KDF have no pinCost column).
+    // Fields are formatted with to_chars into one large buffer that is
+    // flushed in big writes; the file is written to path.tmp and renamed
+    // over path so a crash mid-save never leaves a truncated database.
+    bool writeTsv(const std::string& path) const {
+        const string tmp = path + ".tmp";
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) return false;
+        const size_t kFlushAt = 1 << 20;
+        string buf; buf.reserve(kFlushAt + 512);
+        char num[24];
+        auto field = [&](auto v) { buf.append(num, to_chars(num, num + sizeof num, v).ptr); };
+        forEachAccountUnlocked([&](const AccountView &a) {
+            field(a.id); buf += '\t';
+            size_t at = buf.size();
+            buf += a.owner;
+            for (size_t k = at; k < buf.size(); ++k) if (buf[k] == '\t' || buf[k] == '\n' || buf[k] == '\r') buf[k] = ' ';
+            buf += '\t'; field(a.balanceCents);
+            buf += '\t'; field(a.salt);
+            buf += '\t'; field(a.pinHash);
+            buf += '\t'; field(a.pinCost);
+            buf += '\n';
+            if (buf.size() >= kFlushAt) { out.write(buf.data(), (streamsize)buf.size()); buf.clear(); }
+        });
+        out.write(buf.data(), (streamsize)buf.size());
+        out.close();
+        if (!out) { std::remove(tmp.c_str()); return false; }
+        return std::rename(tmp.c_str(), path.c_str()) == 0;
+    }
+public:
+    // Visits every account once; each balance is read under its stripe, so
+    // this runs alongside deposits/withdrawals (each row is consistent, the
+    // whole pass is not a point-in-time cut).
+    template <class F> void forEachAccount(F &&f) const { forEachAccountImpl(f, true); }
+
+    // A consistent, point-in-time view of every balance, for reports that
+    // shouldn't hold up (or be skewed by) updates. Opening one bumps the
+    // write epoch and waits out the updates already running (no copying;
+    // see readView()), and writers carry on as usual while it's scanned:
+    // an update stamps the account with the current epoch, and the first
+    // update to an account after the view opened saves the balance it
+    // overwrote, which the view reads instead. Accounts created after the
+    // view opened aren't in it; PIN fields aren't part of it. Before-images
+    // are only dropped when the *last* open view closes, so a long-lived
+    // (or overlapping) view costs memory proportional to the distinct
+    // accounts written while it's open: keep views to reporting scans, not
+    // interactive paging. Opening one never blocks Locked-mode writers;
+    // Atomic mode pauses them for one gate drain (see readView()). Close
+    // every view before load/reset, and don't let one outlive its Bank.
+    class ReadView {
+        friend class Bank;
+        const Bank *bank_;
+        uint32_t pin_;
+        size_t bound_; // arena rows that existed at the pin
+        int nextId_;
+        ReadView(const Bank &b, uint32_t pin, size_t bound, int nextId) : bank_(&b), pin_(pin), bound_(bound), nextId_(nextId) {}
+
+        long long balanceAt(const Account &a) const {
+            long long b = a.balanceCents_.load(memory_order_acquire);
+            if (a.epoch_.load(memory_order_acquire) <= pin_) return b; // last written before the pin
+            BeforeStripe &s = bank_->before_[stripeOf(a.id_)];
+            lock_guard<mutex> lk(s.m);
+            for (auto [it, end] = s.images.equal_range(a.id_); it != end; ++it)
+                if (it->second.from <= pin_ && pin_ < it->second.to) return it->second.cents;
+            return b; // not reached: a write past an open view's pin always leaves an image
+        }
+        // The row as of the pin; a slot copied out of the snapshot after it
+        // is read from the snapshot record.
+        bool rowOf(int id, long long &cents, string_view &owner) const {
+            int slot = bank_->index_.find(id);
+            if (slot != AccountIndex::npos && (size_t)slot < bound_) {
+                const Account &a = bank_->accounts_[slot];
+                cents = balanceAt(a); owner = a.owner();
+                return true;
+            }
+            if (bank_->snap_) if (const SnapRecord *r = bank_->snap_->find(id)) { cents = r->balanceCents; owner = bank_->snap_->owner(*r); return true; }
+            return false;
+        }
+    public:
+        ReadView(ReadView &&o) noexcept : bank_(o.bank_), pin_(o.pin_), bound_(o.bound_), nextId_(o.nextId_) { o.bank_ = nullptr; }
+        ReadView& operator=(ReadView &&) = delete;
+        ~ReadView() { if (bank_) bank_->closeView(); }
+
+        bool balanceOf(int id, long long &cents) const { string_view owner; return rowOf(id, cents, owner); }
+
+        // Same order as Bank::forEachAccount; salt/pinHash/pinCost are zero.
+        template <class F> void forEach(F &&f) const {
+            const Bank &b = *bank_;
+            if (b.snap_) {
+                for (size_t i = 0; i < b.snap_->size(); ++i) {
+                    const SnapRecord &r = (*b.snap_)[i];
+                    if (b.snapShadowed_.load(memory_order_relaxed)) {
+                        int slot = b.index_.find(r.id);
+                        if (slot != AccountIndex::npos && (size_t)slot < bound_) continue;
+                    }
+                    f(AccountView{r.id, b.snap_->owner(r), r.balanceCents, 0, 0, 0});
+                }
+            }
+            for (size_t i = 0; i < bound_; ++i) {
+                const Account &a = b.accounts_[i];
+                f(AccountView{a.id_, a.owner(), balanceAt(a), 0, 0, 0});
+            }
+        }
+
+        // Reporting aggregates over the pinned balances.
+        long long totalCents() const { long long t = 0; forEach([&](const AccountView &v) { t += v.balanceCents; }); return t; }
+        size_t countBelow(long long thresholdCents) const {
+            size_t n = 0;
+            forEach([&](const AccountView &v) { n += v.balanceCents < thresholdCents; });
+            return n;
+        }
+        size_t size() const { size_t n = 0; forEach([&](const AccountView &) { ++n; }); return n; }
+    };
+
+    // Locked mode: one epoch bump, then each stripe is taken and released
+    // in turn, which waits out any update still using the old epoch (an
+    // update reads it with its stripes held); no writer waits on more than
+    // one stripe's critical section. Atomic mode has no per-account lock to
+    // order an old-epoch update against a newer one on the same account, so
+    // the bump happens with the gate briefly closed: a drain of in-flight
+    // updates (no stripes, no writeMu_), which does stall writers for it.
+    ReadView readView() const {
+        lock_guard<mutex> lk(viewMu_);
+        if (!before_) before_.reset(new BeforeStripe[kStripes]);
+        views_.fetch_add(1, memory_order_release);
+        uint32_t pin;
+        if (mode_ == BalanceMode::Atomic) {
+            gate_.close();
+            pin = viewEpoch_.fetch_add(1, memory_order_acq_rel); // every later write is stamped past the pin
+            gate_.open();
+        } else {
+            pin = viewEpoch_.fetch_add(1, memory_order_acq_rel);
+            for (size_t i = 0; i < kStripes; ++i) { stripes_[i].m.lock(); stripes_[i].m.unlock(); }
+        }
+        size_t bound = accounts_.size();
+        return ReadView(*this, pin, bound, nextIdSnapshot());
+    }
+private:
+    void closeView() const {
+        lock_guard<mutex> lk(viewMu_);
+        if (views_.fetch_sub(1, memory_order_relaxed) != 1) return;
+        // A writer that saw the view open may still add an image after this;
+        // its range ends at today's epoch, which no later pin falls below.
+        for (size_t i = 0; i < kStripes; ++i) {
+            lock_guard<mutex> g(before_[i].m);
+            before_[i].images.clear();
+        }
+    }
+public:
+
+    // Writes up to limit accounts after `after` (one "ID: .., Owner: ..,
+    // Balance: .." line each) into sink and returns the cursor for the next
+    // page. ById first probes the IDs following the cursor (IDs are nearly
+    // always dense, so that's O(limit)) and falls back to a scan when they
+    // aren't. ByBalance is one pass with a bounded heap, O(n log limit),
+    // instead of sorting everything per page. Rows are read one at a time,
+    // so concurrent updates can move an account across pages; each line is
+    // consistent, the listing as a whole is not a point-in-time cut (list
+    // from a ReadView for that).
+    ListCursor listAccounts(ListCursor after, size_t limit, ListOrder order, TextSink &sink) const {
+        return listPage(after, limit, order, sink, [this] { return nextIdSnapshot(); },
+                        [this](int id, long long &c, string_view &o) { return rowOf(id, c, o); },
+                        [this](auto &&f) { forEachAccount(f); });
+    }
+    // The same page, read from a view: every page of one listing comes from
+    // one point in time, so nothing moves between pages.
+    ListCursor listAccounts(const ReadView &view, ListCursor after, size_t limit, ListOrder order, TextSink &sink) const {
+        return listPage(after, limit, order, sink, [&view] { return view.nextId_; },
+                        [&view](int id, long long &c, string_view &o) { return view.rowOf(id, c, o); },
+                        [&view](auto &&f) { view.forEach(f); });
+    }
+
+private:
+    template <class EndId, class RowOf, class Each>
+    ListCursor listPage(ListCursor after, size_t limit, ListOrder order, TextSink &sink, EndId &&endId, RowOf &&rowOf, Each &&each) const {
+        struct Row { long long balance; int id; string_view owner; };
+        vector<Row> page;
+        if (after.done || limit == 0) return after;
+        // "a comes before b" in the requested order.
+        auto before = [order](const Row &a, const Row &b) {
+            if (order == ListOrder::ById || a.balance == b.balance) return a.id < b.id;
+            return a.balance > b.balance;
+        };
+        const Row cursor{after.balance, after.id, {}};
+        bool probed = false;
+        const bool denseIds = !index_.hasSparse() && (!snap_ || snap_->size() == 0 || (*snap_)[0].id >= 1001);
+        if (order == ListOrder::ById && denseIds) {
+            // Fast path: walk the next IDs directly; give up on long gaps.
+            int id = max(after.id, firstId_ - 1) + 1, misses = 0, end = endId();
+            for (; id < end && page.size() < limit && misses < 1024; ++id) {
+                Row r{0, id, {}};
+                if (rowOf(id, r.balance, r.owner)) { page.push_back(r); misses = 0; } else ++misses;
+            }
+            probed = page.size() == limit || id >= end;
+        }
+        if (!probed) {
+            page.clear();
+            each([&](const AccountView &v) {
+                Row r{v.balanceCents, v.id, v.owner};
+                if (!before(cursor, r)) return;
+                if (page.size() < limit) { page.push_back(r); push_heap(page.begin(), page.end(), before); return; }
+                if (!before(r, page.front())) return;
+                pop_heap(page.begin(), page.end(), before);
+                page.back() = r;
+                push_heap(page.begin(), page.end(), before);
+            });
+            sort_heap(page.begin(), page.end(), before);
+        }
+        string &out = sink.buffer();
+        char num[16];
+        for (const Row &r : page) {
+            out += "ID: ";
+            out.append(num, to_chars(num, num + sizeof num, r.id).ptr);
+            out += ", Owner: "; out += r.owner; out += ", Balance: ";
+            appendCents(out, r.balance);
+            out += '\n';
+            sink.maybeFlush();
+        }
+        ListCursor next = after;
+        if (page.size() < limit) next.done = true;
+        if (!page.empty()) { next.id = page.back().id; next.balance = page.back().balance; }
+        return next;
+    }
+public:
+
+    // Replaces the bank's contents with a mapping of the snapshot at path.
+    // O(1): nothing is parsed or copied up front.
+    bool openSnapshot(const string &path) {
+        StatTimer t(StatOp::Load);
+        auto snap = make_unique<SnapshotFile>();
+        if (!snap->open(path)) return false;
+        reset();
+        snap_ = std::move(snap);
+        nextId_ = max(firstId_, snap_->nextId());
+        lsn_ = baseLsn_ = snap_->lastLsn();
+        return true;
+    }
+
+    bool verifySnapshot() const { return !snap_ || snap_->verify(); }
+
+    // Starts recording statement history, keeping about the newest `entries`
+    // entries across all accounts. Call before sharing the bank.
+    void enableHistory(size_t entries) { history_ = make_unique<TransactionHistory>(entries); }
+    const TransactionHistory* history() const { return history_.get(); }
+    // Newest first, appended to out; nothing if history is off.
+    size_t lastTransactions(int id, size_t n, vector<HistoryEntry> &out) const { return history_ ? history_->last(id, n, out) : 0; }
+    size_t transactionsBetween(int id, int64_t fromUs, int64_t toUs, vector<HistoryEntry> &out, size_t limit = SIZE_MAX) const {
+        return history_ ? history_->range(id, fromUs, toUs, out, limit) : 0;
+    }
+
+    // Point-in-time saves: hold every lock while writing.
+    bool saveSnapshot(const string &path) const { StatTimer t(StatOp::Save); lockAll(); bool ok = writeSnapshot(path); unlockAll(); return ok; }
+    bool saveToFile(const std::string& path) const { StatTimer t(StatOp::Save); lockAll(); bool ok = writeTsv(path); unlockAll(); return ok; }
+
+    size_t size() const { return accounts_.size() + (snap_ ? snap_->size() - snapShadowed_ : 0); }
+
+    // Streams the file through a fixed read buffer and parses each line in
+    // place (string_view + from_chars). The ID index and nextId_ are rebuilt
+    // in the same pass. Malformed lines and duplicate IDs are skipped.
+    // Not thread-safe: load before sharing the bank.
+    bool loadFromFile(const std::string& path) {
+        StatTimer t(StatOp::Load);
+        ifstream in(path, std::ios::binary);
+        if (!in) return false;
+
+        reset();
+        int maxId = firstId_ - 1;
+        const size_t kChunk = 1 << 20;
+        vector<char> buf(kChunk);
+        size_t have = 0;  // bytes of a partial line carried over from the last read
+        auto parseLine = [&](const char *p, const char *end) {
+            if (end > p && end[-1] == '\r') --end;
+            int id; long long bal; size_t salt, hash; unsigned cost = 0;
+            auto r = from_chars(p, end, id);
+            if (r.ec != errc() || r.ptr == end || *r.ptr != '\t') return;
+            const char *ownerBeg = r.ptr + 1;
+            const char *ownerEnd = (const char *)memchr(ownerBeg, '\t', (size_t)(end - ownerBeg));
+            if (!ownerEnd) return;
+            r = from_chars(ownerEnd + 1, end, bal);
+            if (r.ec != errc() || r.ptr == end || *r.ptr != '\t') return;
+            r = from_chars(r.ptr + 1, end, salt);
+            if (r.ec != errc() || r.ptr == end || *r.ptr != '\t') return;
+            r = from_chars(r.ptr + 1, end, hash);
+            if (r.ec != errc()) return;
+            if (r.ptr != end) {
+                if (*r.ptr != '\t') return;
+                r = from_chars(r.ptr + 1, end, cost);
+                if (r.ec != errc() || r.ptr != end || cost > kMaxPinCost) return;
+            }
+            if (index_.find(id) != AccountIndex::npos) return;
+            accounts_.emplace_back(id, ownerNames().intern(string_view(ownerBeg, (size_t)(ownerEnd - ownerBeg))), bal, salt, hash, cost);
+            index_.insert(id, (int)accounts_.size() - 1);
+            maxId = max(maxId, id);
+        };
+        while (true) {
+            if (have == buf.size()) buf.resize(buf.size() * 2); // line longer than the buffer
+            in.read(buf.data() + have, (streamsize)(buf.size() - have));
+            size_t len = have + (size_t)in.gcount();
+            if (len == have) { if (have) parseLine(buf.data(), buf.data() + have); break; }
+            const char *p = buf.data(), *end = buf.data() + len;
+            while (const char *nl = (const char *)memchr(p, '\n', (size_t)(end - p))) {
+                parseLine(p, nl);
+                p = nl + 1;
+            }
+            have = (size_t)(end - p);
+            memmove(buf.data(), p, have);
+        }
+        nextId_ = maxId + 1;
+        rebuildOwnersLocked();
+        return true;
+    }
+};
+
+// ---------------- Sharded bank ----------------
+// N independent Banks, each owning one contiguous slice of the dense ID
+// space (shard k assigns IDs from 1001 + k * range), so routing an ID is a
+// division and shards share no lock, counter, arena, index or log. Each
+// shard keeps its own files: path.<k> for the snapshot, TSV and WAL.
+// Creation spreads across shards round-robin per thread.
+//
+// Transfers inside one shard are Bank::transfer. Across shards they are
+// not two-phase commit: they're a logged-halves protocol with repair on
+// recovery, and never hold both shards' locks. The source half debits
+// (funds check included) and logs XferOut(txid) in the source shard's WAL;
+// the destination half credits and logs XferIn(txid) in its own. If the
+// credit is refused (balance limit), the source is refunded and the
+// refund logged as an XferIn with the same txid in the source's WAL,
+// which pairs the halves there. In between, a reader may see the money in
+// neither account (as in Atomic mode). The two WALs sync independently,
+// so a crash can keep one half without the other: recover() pairs the
+// halves by txid and re-applies the missing one (the survivor proves the
+// transfer was accepted), and attachWal() logs that repair. A crash
+// between a refused credit and its logged refund therefore recovers as a
+// completed transfer, the one way a balance can pass the limit.
+// checkpoint() closes a gate the cross-shard path passes through, so no
+// transfer straddles the snapshot cut. Background checkpoints are per-Bank
+// and don't coordinate shards, so ShardedBank only checkpoints synchronously.
+class ShardedBank {
+public:
+    static constexpr size_t kMaxShards = 256; // low 8 bits of a txid name its source shard
+private:
+    struct alignas(64) Shard { unique_ptr<Bank> bank; atomic<uint64_t> nextTx{1}; };
+    size_t n_;
+    int range_;
+    unique_ptr<Shard[]> shards_;
+    mutable UpdateGate xferGate_; // cross-shard transfers inside, checkpoint() closes it
+    vector<pair<size_t, Bank::XferHalf>> repairs_; // applied by recover(), logged by attachWal()
+
+    static string shardPath(const string &path, size_t k) { return path + "." + to_string(k); }
+    Bank& bankOf(const Account &a) const { return *shards_[shardOf(a.id())].bank; }
+public:
+    explicit ShardedBank(size_t shards, BalanceMode mode = BalanceMode::Locked)
+        : n_(min(max<size_t>(shards, 1), kMaxShards)), range_((int)(AccountIndex::kDenseIds / n_)), shards_(new Shard[n_]) {
+        for (size_t k = 0; k < n_; ++k) shards_[k].bank = make_unique<Bank>(mode, 1001 + (int)k * range_, 1001 + (int)(k + 1) * range_);
+    }
+    ShardedBank(const ShardedBank &) = delete;
+    ShardedBank& operator=(const ShardedBank &) = delete;
+
+    size_t shardCount() const { return n_; }
+    // Shard owning id, or shardCount() if it's outside every shard's range.
+    size_t shardOf(int id) const { return id < 1001 ? n_ : min(n_, (size_t)((id - 1001) / range_)); }
+    Bank& shard(size_t k) { return *shards_[k].bank; }
+
+    int createAccount(const string &owner, const string &pin) {
+        static thread_local size_t next = hash<thread::id>{}(this_thread::get_id());
+        return shards_[next++ % n_].bank->createAccount(owner, pin);
+    }
+
+    Account* findById(int id) { size_t k = shardOf(id); return k < n_ ? shards_[k].bank->findById(id) : nullptr; }
+    Account* login(int id, const string &pin) { size_t k = shardOf(id); return k < n_ ? shards_[k].bank->login(id, pin) : nullptr; }
+    bool balanceOf(int id, long long &cents) const { size_t k = shardOf(id); return k < n_ && shards_[k].bank->balanceOf(id, cents); }
+
+    OpStatus tryDeposit(Account &a, long long cents, long long &balance) noexcept { return bankOf(a).tryDeposit(a, cents, balance); }
+    OpStatus tryWithdraw(Account &a, long long cents, long long &balance) noexcept { return bankOf(a).tryWithdraw(a, cents, balance); }
+    OpStatus tryTransfer(Account &from, Account &to, long long cents, long long &balance) noexcept {
+        size_t a = shardOf(from.id()), b = shardOf(to.id());
+        if (a == b) return shards_[a].bank->tryTransfer(from, to, cents, balance);
+        StatTimer t(StatOp::Transfer);
+        if (cents <= 0) return OpStatus::InvalidAmount;
+        UpdateGate::Scope g(xferGate_);
+        uint64_t txid = shards_[a].nextTx.fetch_add(1, memory_order_relaxed) << 8 | a;
+        OpStatus st = shards_[a].bank->debitOut(from, cents, txid, to.id(), balance);  // source half
+        if (st != OpStatus::Ok) return countDecline(st);
+        if ((st = shards_[b].bank->creditIn(to, cents, txid, from.id())) != OpStatus::Ok) // destination half
+            shards_[a].bank->refundOut(from, cents, txid, to.id()); // refused: compensate at the source
+        return st;
+    }
+
+    long long deposit(Account &a, long long cents) { return bankOf(a).deposit(a, cents); }
+    long long withdraw(Account &a, long long cents) { return bankOf(a).withdraw(a, cents); }
+    long long transfer(Account &from, Account &to, long long cents) {
+        long long bal = 0;
+        if (OpStatus s = tryTransfer(from, to, cents, bal); s != OpStatus::Ok) throwOpStatus(s, "Transfer must be positive");
+        return bal;
+    }
+
+    size_t size() const { size_t n = 0; for (size_t k = 0; k < n_; ++k) n += shards_[k].bank->size(); return n; }
+
+    // Shard by shard, each in parallel as Bank::accrue.
+    AccrualResult accrue(const AccrualRule &rule, unsigned threads = 0) {
+        AccrualResult total;
+        for (size_t k = 0; k < n_; ++k) {
+            AccrualResult r = shards_[k].bank->accrue(rule, threads);
+            total.accounts += r.accounts; total.chunks += r.chunks; total.capped += r.capped;
+            total.creditedCents += r.creditedCents; total.debitedCents += r.debitedCents;
+        }
+        return total;
+    }
+
+    // History lives with each shard's accounts; entries is split evenly.
+    void enableHistory(size_t entries) { for (size_t k = 0; k < n_; ++k) shards_[k].bank->enableHistory(entries / n_); }
+    size_t lastTransactions(int id, size_t n, vector<HistoryEntry> &out) const {
+        size_t k = shardOf(id);
+        return k < n_ ? shards_[k].bank->lastTransactions(id, n, out) : 0;
+    }
+    size_t transactionsBetween(int id, int64_t fromUs, int64_t toUs, vector<HistoryEntry> &out, size_t limit = SIZE_MAX) const {
+        size_t k = shardOf(id);
+        return k < n_ ? shards_[k].bank->transactionsBetween(id, fromUs, toUs, out, limit) : 0;
+    }
+    // Shard by shard, each as Bank::forEachAccount (no cut across shards).
+    template <class F> void forEachAccount(F &&f) const { for (size_t k = 0; k < n_; ++k) shards_[k].bank->forEachAccount(f); }
+
+    // Recovers every shard from path.<k>, then settles cross-shard
+    // transfers that only one shard's log kept. A half covered by its
+    // shard's snapshot needs nothing: checkpoint() syncs every WAL before
+    // writing any snapshot, so its partner is durable too.
+    bool recover(const string &snapPath, const string &tsvPath, const string &walPath) {
+        bool ok = true;
+        for (size_t k = 0; k < n_; ++k) ok = shards_[k].bank->recover(shardPath(snapPath, k), shardPath(tsvPath, k), shardPath(walPath, k)) && ok;
+        struct Seen { const Bank::XferHalf *half = nullptr; int count = 0; };
+        unordered_map<uint64_t, Seen> seen;
+        for (size_t k = 0; k < n_; ++k) {
+            for (const Bank::XferHalf &h : shards_[k].bank->xferHalves_) {
+                Seen &s = seen[h.txid];
+                s.half = &h; ++s.count;
+                size_t src = (size_t)(h.txid & 0xff);
+                if (src < n_) shards_[src].nextTx = max(shards_[src].nextTx.load(), (h.txid >> 8) + 1);
+            }
+        }
+        repairs_.clear();
+        for (auto &[txid, s] : seen) {
+            if (s.count > 1 || s.half->covered) continue;
+            const Bank::XferHalf &h = *s.half;
+            size_t k = shardOf(h.other);
+            if (k >= n_) continue;
+            Bank::XferHalf missing{txid, h.other, h.id, h.cents, !h.out, false};
+            shards_[k].bank->applyHalf(missing);
+            repairs_.push_back({k, missing});
+        }
+        for (size_t k = 0; k < n_; ++k) { shards_[k].bank->xferHalves_.clear(); shards_[k].bank->xferHalves_.shrink_to_fit(); }
+        return ok;
+    }
+    size_t recoveredRepairs() const { return repairs_.size(); }
+
+    // Per-shard WALs at path.<k>. Call after recover().
+    bool attachWal(const string &path, WalOptions opt = {}) {
+        for (size_t k = 0; k < n_; ++k) if (!shards_[k].bank->attachWal(shardPath(path, k), opt)) return false;
+        for (auto &[k, h] : repairs_) shards_[k].bank->logHalf(h);
+        if (!repairs_.empty()) syncWal();
+        repairs_.clear();
+        return true;
+    }
+    void syncWal() { for (size_t k = 0; k < n_; ++k) shards_[k].bank->syncWal(); }
+
+    // Stop-the-world: no cross-shard transfer in flight, every shard
+    // locked, every WAL synced, then every snapshot + TSV written, and only
+    // then any log truncated, so a crash at any point leaves each transfer
+    // either wholly in the snapshots or with both halves in the logs.
+    bool checkpoint(const string &snapPath, const string &tsvPath) {
+        StatTimer t(StatOp::Save);
+        xferGate_.close();
+        for (size_t k = 0; k < n_; ++k) shards_[k].bank->pollCheckpoint(true);
+        for (size_t k = 0; k < n_; ++k) shards_[k].bank->lockAll();
+        for (size_t k = 0; k < n_; ++k) if (shards_[k].bank->wal_) shards_[k].bank->wal_->sync();
+        bool ok = true;
+        for (size_t k = 0; k < n_ && ok; ++k)
+            ok = shards_[k].bank->writeSnapshot(shardPath(snapPath, k)) && shards_[k].bank->writeTsv(shardPath(tsvPath, k));
+        for (size_t k = 0; k < n_ && ok; ++k) ok = shards_[k].bank->dropLoggedLocked();
+        for (size_t k = n_; k-- > 0;) shards_[k].bank->unlockAll();
+        xferGate_.open();
+        return ok;
+    }
+};
+
+// ---------------- Request engine ----------------
+// Runs Bank requests as tasks on a fixed pool of workers. Each worker has
+// its own deque: a request keyed by an account ID always goes to that
+// account's worker (ID mod workers), so an account's stripe and cache lines
+// stay on one core instead of bouncing between client threads. A worker
+// runs its own deque oldest-first and, when it is empty, steals the newest
+// task from another worker's deque, so one hot account can't leave the
+// rest of the pool idle. Unstolen tasks for one key run in submission
+// order; a stolen one may overtake it (Bank ops are thread-safe, so that
+// only reorders independent requests; clients that need ordering wait for
+// each result, as the CLI does). Exceptions reach the caller through the
+// future. The destructor runs every queued task before joining.
+class RequestEngine {
+    struct alignas(64) Worker { mutex m; deque<function<void()>> q; };
+    size_t n_;
+    unique_ptr<Worker[]> workers_;
+    vector<thread> threads_;
+    atomic<long long> queued_{0};   // tasks pushed and not yet popped
+    atomic<long long> pending_{0};  // tasks posted and not yet finished
+    atomic<int> sleepers_{0};
+    atomic<bool> stop_{false};
+    atomic<uint64_t> steals_{0};
+    mutex sleepMu_, doneMu_;
+    condition_variable wake_, done_;
+
+    bool popOwn(size_t self, function<void()> &task) {
+        Worker &w = workers_[self];
+        lock_guard<mutex> lk(w.m);
+        if (w.q.empty()) return false;
+        task = std::move(w.q.front()); w.q.pop_front();
+        return true;
+    }
+    bool steal(size_t self, function<void()> &task) {
+        for (size_t i = 1; i < n_; ++i) {
+            Worker &v = workers_[(self + i) % n_];
+            unique_lock<mutex> lk(v.m, try_to_lock); // skip a busy victim rather than queue behind it
+            if (!lk || v.q.empty()) continue;
+            task = std::move(v.q.back()); v.q.pop_back();
+            steals_.fetch_add(1, memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+    void run(size_t self) {
+        function<void()> task;
+        while (true) {
+            if (popOwn(self, task) || steal(self, task)) {
+                queued_.fetch_sub(1, memory_order_relaxed);
+                task(); task = nullptr;
+                if (pending_.fetch_sub(1, memory_order_acq_rel) == 1) { lock_guard<mutex> lk(doneMu_); done_.notify_all(); }
+                continue;
+            }
+            // Sleep until a post makes queued_ positive. sleepers_ and
+            // queued_ are both seq_cst, so either the poster sees this
+            // sleeper and notifies, or this thread sees the new task.
+            unique_lock<mutex> lk(sleepMu_);
+            sleepers_.fetch_add(1, memory_order_seq_cst);
+            wake_.wait(lk, [&] { return stop_.load() || queued_.load(memory_order_seq_cst) > 0; });
+            sleepers_.fetch_sub(1, memory_order_relaxed);
+            if (stop_ && queued_ <= 0) return;
+        }
+    }
+public:
+    explicit RequestEngine(size_t workers = max(1u, thread::hardware_concurrency()))
+        : n_(max<size_t>(workers, 1)), workers_(new Worker[n_]) {
+        for (size_t k = 0; k < n_; ++k) threads_.emplace_back([this, k] { run(k); });
+    }
+    RequestEngine(const RequestEngine &) = delete;
+    RequestEngine& operator=(const RequestEngine &) = delete;
+    ~RequestEngine() {
+        wait();
+        { lock_guard<mutex> lk(sleepMu_); stop_ = true; }
+        wake_.notify_all();
+        for (auto &t : threads_) t.join();
+    }
+
+    size_t workers() const { return n_; }
+    size_t workerFor(int accountId) const { return (unsigned)accountId % n_; }
+    uint64_t steals() const { return steals_.load(memory_order_relaxed); }
+
+    // Fire-and-forget on key's worker.
+    void post(int key, function<void()> task) {
+        pending_.fetch_add(1, memory_order_relaxed);
+        queued_.fetch_add(1, memory_order_seq_cst); // before the push, so a popper never drives it negative
+        Worker &w = workers_[workerFor(key)];
+        { lock_guard<mutex> lk(w.m); w.q.push_back(std::move(task)); }
+        if (sleepers_.load(memory_order_seq_cst) > 0) { lock_guard<mutex> lk(sleepMu_); wake_.notify_one(); }
+    }
+    // Un-keyed requests (account creation, listings) spread round-robin per client thread.
+    void post(function<void()> task) {
+        static thread_local unsigned next = (unsigned)hash<thread::id>{}(this_thread::get_id());
+        post((int)(next++ & INT_MAX), std::move(task));
+    }
+
+    template <class F> auto submit(int key, F f) -> future<decltype(f())> {
+        auto task = make_shared<packaged_task<decltype(f())()>>(std::move(f));
+        auto fut = task->get_future();
+        post(key, [task] { (*task)(); });
+        return fut;
+    }
+    template <class F> auto submit(F f) -> future<decltype(f())> {
+        auto task = make_shared<packaged_task<decltype(f())()>>(std::move(f));
+        auto fut = task->get_future();
+        post([task] { (*task)(); });
+        return fut;
+    }
+
+    // Blocks until every task posted so far (and any they posted) has run.
+    void wait() {
+        unique_lock<mutex> lk(doneMu_);
+        done_.wait(lk, [&] { return pending_.load(memory_order_acquire) == 0; });
+    }
+};
+
+// ---------------- Balance kernels ----------------
+// Reporting kernels over a contiguous column of cents: total, count below a
+// threshold, min/max and histogram. Each has a scalar version plus AVX2
+// (x86-64, chosen at runtime via cpuid) and NEON (AArch64, always present)
+// versions. Sums wrap mod 2^64 in every path, so all paths return
+// bit-identical results; `./bank --bench` cross-checks them.
+// BANK_SIMD=scalar in the environment forces the scalar path.
+struct BalanceKernels {
+    const char *name;
+    long long (*sum)(const long long *v, size_t n);
+    size_t (*countBelow)(const long long *v, size_t n, long long threshold);
+    void (*minMax)(const long long *v, size_t n, long long &mn, long long &mx);
+};
+
+static long long sumScalar(const long long *v, size_t n) {
+    unsigned long long s = 0;
+    for (size_t i = 0; i < n; ++i) s += (unsigned long long)v[i];
+    return (long long)s;
+}
+
+static size_t countBelowScalar(const long long *v, size_t n, long long threshold) {
+    size_t c = 0;
+    for (size_t i = 0; i < n; ++i) c += v[i] < threshold;
+    return c;
+}
+
+static void minMaxScalar(const long long *v, size_t n, long long &mn, long long &mx) {
+    mn = LLONG_MAX; mx = LLONG_MIN;
+    for (size_t i = 0; i < n; ++i) { mn = min(mn, v[i]); mx = max(mx, v[i]); }
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BANK_HAVE_AVX2 1
+__attribute__((target("avx2"))) static long long sumAvx2(const long long *v, size_t n) {
+    __m256i a0 = _mm256_setzero_si256(), a1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        a0 = _mm256_add_epi64(a0, _mm256_loadu_si256((const __m256i *)(v + i)));
+        a1 = _mm256_add_epi64(a1, _mm256_loadu_si256((const __m256i *)(v + i + 4)));
+    }
+    alignas(32) unsigned long long lanes[4];
+    _mm256_store_si256((__m256i *)lanes, _mm256_add_epi64(a0, a1));
+    unsigned long long s = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; i < n; ++i) s += (unsigned long long)v[i];
+    return (long long)s;
+}
+
+__attribute__((target("avx2"))) static size_t countBelowAvx2(const long long *v, size_t n, long long threshold) {
+    const __m256i t = _mm256_set1_epi64x(threshold);
+    __m256i acc = _mm256_setzero_si256();       // each lane counts down by 1 per match
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        acc = _mm256_add_epi64(acc, _mm256_cmpgt_epi64(t, _mm256_loadu_si256((const __m256i *)(v + i))));
+    alignas(32) long long lanes[4];
+    _mm256_store_si256((__m256i *)lanes, acc);
+    size_t c = (size_t)-(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+    for (; i < n; ++i) c += v[i] < threshold;
+    return c;
+}
+
+__attribute__((target("avx2"))) static void minMaxAvx2(const long long *v, size_t n, long long &mn, long long &mx) {
+    __m256i lo = _mm256_set1_epi64x(LLONG_MAX), hi = _mm256_set1_epi64x(LLONG_MIN);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(v + i));
+        lo = _mm256_blendv_epi8(lo, x, _mm256_cmpgt_epi64(lo, x));
+        hi = _mm256_blendv_epi8(hi, x, _mm256_cmpgt_epi64(x, hi));
+    }
+    alignas(32) long long l[4], h[4];
+    _mm256_store_si256((__m256i *)l, lo); _mm256_store_si256((__m256i *)h, hi);
+    mn = min(min(l[0], l[1]), min(l[2], l[3]));
+    mx = max(max(h[0], h[1]), max(h[2], h[3]));
+    for (; i < n; ++i) { mn = min(mn, v[i]); mx = max(mx, v[i]); }
+}
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define BANK_HAVE_NEON 1
+static long long sumNeon(const long long *v, size_t n) {
+    uint64x2_t a0 = vdupq_n_u64(0), a1 = vdupq_n_u64(0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        a0 = vaddq_u64(a0, vreinterpretq_u64_s64(vld1q_s64(v + i)));
+        a1 = vaddq_u64(a1, vreinterpretq_u64_s64(vld1q_s64(v + i + 2)));
+    }
+    unsigned long long s = vaddvq_u64(vaddq_u64(a0, a1));
+    for (; i < n; ++i) s += (unsigned long long)v[i];
+    return (long long)s;
+}
+
+static size_t countBelowNeon(const long long *v, size_t n, long long threshold) {
+    const int64x2_t t = vdupq_n_s64(threshold);
+    uint64x2_t acc = vdupq_n_u64(0);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        acc = vsubq_u64(acc, vcltq_s64(vld1q_s64(v + i), t)); // mask is all-ones -> +1
+    size_t c = (size_t)vaddvq_u64(acc);
+    for (; i < n; ++i) c += v[i] < threshold;
+    return c;
+}
+
+static void minMaxNeon(const long long *v, size_t n, long long &mn, long long &mx) {
+    int64x2_t lo = vdupq_n_s64(LLONG_MAX), hi = vdupq_n_s64(LLONG_MIN);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        int64x2_t x = vld1q_s64(v + i);
+        lo = vbslq_s64(vcltq_s64(x, lo), x, lo);
+        hi = vbslq_s64(vcgtq_s64(x, hi), x, hi);
+    }
+    mn = min(vgetq_lane_s64(lo, 0), vgetq_lane_s64(lo, 1));
+    mx = max(vgetq_lane_s64(hi, 0), vgetq_lane_s64(hi, 1));
+    for (; i < n; ++i) { mn = min(mn, v[i]); mx = max(mx, v[i]); }
+}
+#endif
+
+static const BalanceKernels kScalarKernels{"scalar", sumScalar, countBelowScalar, minMaxScalar};
+#ifdef BANK_HAVE_AVX2
+static const BalanceKernels kAvx2Kernels{"avx2", sumAvx2, countBelowAvx2, minMaxAvx2};
+#endif
+#ifdef BANK_HAVE_NEON
+static const BalanceKernels kNeonKernels{"neon", sumNeon, countBelowNeon, minMaxNeon};
+#endif
+
+// Every kernel set this binary/CPU can run, best first.
+static vector<const BalanceKernels *> availableKernels() {
+    vector<const BalanceKernels *> v;
+#ifdef BANK_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) v.push_back(&kAvx2Kernels);
+#endif
+#ifdef BANK_HAVE_NEON
+    v.push_back(&kNeonKernels);
+#endif
+    v.push_back(&kScalarKernels);
+    return v;
+}
+
+static const BalanceKernels& balanceKernels() {
+    static const BalanceKernels *k = [] {
+        const char *env = getenv("BANK_SIMD");
+        if (env && string(env) == "scalar") return &kScalarKernels;
+        return availableKernels().front();
+    }();
+    return *k;
+}
+
+// Histogram with bucket edges e[0] < e[1] < ... < e[k-1]; counts gets k+1
+// buckets: (-inf, e0), [e0, e1), ..., [e(k-1), +inf). Runs countBelow per
+// edge over L1-sized blocks, so the column is streamed from memory once.
+static vector<size_t> balanceHistogram(const BalanceKernels &k, const long long *v, size_t n,
+                                       const vector<long long> &edges) {
+    const size_t kBlock = 2048;
+    vector<size_t> below(edges.size(), 0);
+    for (size_t off = 0; off < n; off += kBlock) {
+        size_t len = min(kBlock, n - off);
+        for (size_t e = 0; e < edges.size(); ++e) below[e] += k.countBelow(v + off, len, edges[e]);
+    }
+    vector<size_t> counts(edges.size() + 1);
+    size_t prev = 0;
+    for (size_t e = 0; e < edges.size(); ++e) { counts[e] = below[e] - prev; prev = below[e]; }
+    counts[edges.size()] = n - prev;
+    return counts;
+}
+
+// ---------------- Columnar bank ----------------
+// Structure-of-arrays backend: IDs, balances and credentials live in separate
+// contiguous columns instead of one Account object per row. Bulk jobs (totals,
+// "who is below X", top-N) only touch the long long balance column, so every
+// cache line they pull is 8 balances rather than a fraction of an Account with
+// its owner string header and salt/hash. Row i of every column is the same
+// account; the ID index maps id -> row. Same rules as Account/Bank.
+class ColumnarBank {
+    vector<int> ids_;
+    vector<long long> balances_;    // hot: scanned by every report
+    vector<size_t> salts_, pinHashes_;
+    vector<uint8_t> pinCosts_;
+    vector<uint32_t> owners_;       // cold; OwnerNames IDs
+    AccountIndex index_;
+    int nextId_ = 1001;
+
+    size_t row(int id) const {
+        int r = index_.find(id);
+        if (r == AccountIndex::npos) throw out_of_range("No such account");
+        return (size_t)r;
+    }
+public:
+    void reserve(size_t n) {
+        ids_.reserve(n); balances_.reserve(n); salts_.reserve(n); pinHashes_.reserve(n); pinCosts_.reserve(n); owners_.reserve(n);
+        index_.reserve(n);
+    }
+
+    int createAccount(const string &owner, const string &pin) {
+        if (!validPin(pin)) throw invalid_argument("PIN must be 4-12 digits");
+        size_t salt = makeSalt();
+        unsigned cost = g_pinCost.load(memory_order_relaxed);
+        ids_.push_back(nextId_);
+        balances_.push_back(0);
+        salts_.push_back(salt);
+        pinHashes_.push_back(hashPin(pin, salt, cost));
+        pinCosts_.push_back((uint8_t)cost);
+        owners_.push_back(ownerNames().intern(owner));
+        index_.insert(nextId_, (int)ids_.size() - 1);
+        return nextId_++;
+    }
+
+    bool login(int id, const string &pin) const {
+        int r = index_.find(id);
+        return r != AccountIndex::npos && hashPin(pin, salts_[r], pinCosts_[r]) == pinHashes_[r];
+    }
+
+    bool contains(int id) const { return index_.find(id) != AccountIndex::npos; }
+    size_t size() const { return ids_.size(); }
+    string_view owner(int id) const { return ownerNames().get(owners_[row(id)]); }
+    long long balanceCents(int id) const { return balances_[row(id)]; }
+
+    void deposit(int id, long long cents) {
+        if (cents <= 0) throw invalid_argument("Deposit must be positive");
+        long long &bal = balances_[row(id)], sum;
+        if (__builtin_add_overflow(bal, cents, &sum) || sum > kMaxBalanceCents) throw overflow_error("Balance limit exceeded");
+        bal = sum;
+    }
+
+    void withdraw(int id, long long cents) {
+        if (cents <= 0) throw invalid_argument("Withdrawal must be positive");
+        long long &bal = balances_[row(id)];
+        if (cents > bal) throw runtime_error("Insufficient funds");
+        bal -= cents;
+    }
+
+    // Raw balance column, for reporting kernels.
+    const long long* balanceData() const { return balances_.data(); }
+
+    // ---- bulk queries: balance column only ----
+    long long totalCents() const { return balanceKernels().sum(balances_.data(), balances_.size()); }
+
+    size_t countBelow(long long thresholdCents) const {
+        return balanceKernels().countBelow(balances_.data(), balances_.size(), thresholdCents);
+    }
+
+    // LLONG_MAX/LLONG_MIN when empty.
+    pair<long long, long long> minMaxCents() const {
+        long long mn, mx;
+        balanceKernels().minMax(balances_.data(), balances_.size(), mn, mx);
+        return {mn, mx};
+    }
+
+    // See balanceHistogram for bucket layout.
+    vector<size_t> histogram(const vector<long long> &edges) const {
+        return balanceHistogram(balanceKernels(), balances_.data(), balances_.size(), edges);
+    }
+
+    // IDs of accounts with balance < thresholdCents (e.g. 0 for overdrawn).
+    vector<int> idsBelow(long long thresholdCents) const {
+        vector<int> out;
+        for (size_t i = 0; i < balances_.size(); ++i)
+            if (balances_[i] < thresholdCents) out.push_back(ids_[i]);
+        return out;
+    }
+
+    // Top n accounts by balance, richest first, as (id, cents). Keeps a small
+    // min-heap of rows while scanning the balance column: O(N log n).
+    vector<pair<int, long long>> topByBalance(size_t n) const {
+        auto cmp = [&](size_t a, size_t b) { return balances_[a] > balances_[b]; };
+        vector<size_t> heap;
+        if (n == 0) return {};
+        heap.reserve(n + 1);
+        for (size_t i = 0; i < balances_.size(); ++i) {
+            if (heap.size() < n) { heap.push_back(i); push_heap(heap.begin(), heap.end(), cmp); }
+            else if (balances_[i] > balances_[heap.front()]) {
+                pop_heap(heap.begin(), heap.end(), cmp); heap.back() = i; push_heap(heap.begin(), heap.end(), cmp);
+            }
+        }
+        sort_heap(heap.begin(), heap.end(), cmp);
+        vector<pair<int, long long>> out;
+        for (size_t r : heap) out.emplace_back(ids_[r], balances_[r]);
+        return out;
+    }
+};
+
+// ---------------- Network server ----------------
+// ./bank --serve [port]: TCP front-end over the request engine. One epoll
+// thread owns every socket and never blocks on the bank: each decoded
+// request runs on the engine keyed by its account (no thread per
+// connection), and results come back through a completion queue and an
+// eventfd. Responses that complete together go out in one send() per
+// connection.
+//
+// Frames are length-prefixed, fields in host byte order (little-endian on
+// every supported target):
+//   request:  u32 len | u32 tag | u8 op | body    (len counts tag..body)
+//   response: u32 len = 13 | u32 tag | u8 status | i64 value
+// A client may pipeline any number of requests on one connection;
+// responses echo the request's tag and may be reordered, since requests on
+// different accounts run in parallel. Bodies:
+//   Create             u8 n, owner[n], u8 m, pin[m]   -> new account ID
+//   Login              i32 id, u8 m, pin[m]           -> session token
+//   Balance            i32 id, u64 token              -> balance (cents)
+//   Deposit, Withdraw  i32 id, u64 token, i64 cents   -> new balance
+//   Transfer           i32 id, u64 token, i32 to, i64 cents -> source's new balance
+//   Logout             i32 id, u64 token
+// status is an OpStatus, or kWireAuthFailed (bad PIN or session) or
+// kWireBadRequest (malformed body; an oversized frame also closes the
+// connection).
+// A connection that opens with "GET " (too long to be a frame length) is
+// answered with the Prometheus stats dump over HTTP/1.0 and closed, so
+// the server port doubles as a /metrics scrape target.
+enum class WireOp : uint8_t { Create = 1, Login = 2, Balance = 3, Deposit = 4, Withdraw = 5, Transfer = 6, Logout = 7 };
+static constexpr uint8_t kWireAuthFailed = 100, kWireBadRequest = 101;
+static constexpr size_t kWireResponse = 17, kWireMaxFrame = 1024;
+
+static void wireResponse(char *out, uint32_t tag, uint8_t status, int64_t value) {
+    uint32_t len = (uint32_t)kWireResponse - 4;
+    memcpy(out, &len, 4); memcpy(out + 4, &tag, 4); out[8] = (char)status; memcpy(out + 9, &value, 8);
+}
+
+class BankServer {
+    struct Conn { int fd; string in, out; size_t inflight = 0; uint32_t events = 0; bool eof = false, framed = false; };
+    struct Done { uint64_t conn; char frame[kWireResponse]; };
+    static constexpr uint64_t kListenKey = 0, kWakeKey = 1, kStopKey = 2;
+    static constexpr size_t kMaxInflight = 4096; // per connection; reading pauses beyond it
+
+    Bank &bank_;
+    RequestEngine &engine_;
+    int listen_ = -1, ep_ = -1, wake_ = -1, port_ = 0;
+    unordered_map<uint64_t, Conn> conns_;
+    uint64_t nextConn_ = 16;
+    mutex doneMu_;
+    vector<Done> done_;
+    atomic<bool> stop_{false};
+    atomic<uint64_t> requests_{0};
+
+    void watch(int fd, uint64_t key, uint32_t events, int op = EPOLL_CTL_ADD) {
+        epoll_event ev{}; ev.events = events; ev.data.u64 = key;
+        epoll_ctl(ep_, op, fd, &ev);
+    }
+
+    // Runs on an engine worker.
+    void complete(uint64_t conn, uint32_t tag, uint8_t status, int64_t value) {
+        Done d; d.conn = conn;
+        wireResponse(d.frame, tag, status, value);
+        bool first;
+        { lock_guard<mutex> lk(doneMu_); first = done_.empty(); done_.push_back(d); }
+        if (first) { uint64_t one = 1; ssize_t w = ::write(wake_, &one, 8); (void)w; } // one wakeup per batch
+    }
+
+    void execute(uint64_t conn, uint32_t tag, WireOp op, int id, uint64_t token, int to, long long cents, const string &a, const string &b) {
+        long long v = 0;
+        uint8_t st = (uint8_t)OpStatus::Ok;
+        Account *acc = nullptr;
+        if (op != WireOp::Create && op != WireOp::Login && !(acc = bank_.resume(id, token))) { complete(conn, tag, kWireAuthFailed, 0); return; }
+        switch (op) {
+            case WireOp::Create:
+                if (!validPin(b)) { st = (uint8_t)OpStatus::InvalidPin; break; }
+                try { v = bank_.createAccount(a, b); } catch (const exception &) { st = kWireBadRequest; }
+                break;
+            case WireOp::Login: {
+                uint64_t t = bank_.openSession(id, a);
+                if (!t) st = kWireAuthFailed; else memcpy(&v, &t, 8);
+                break;
+            }
+            case WireOp::Balance: v = bank_.balanceCents(*acc); break;
+            case WireOp::Deposit: st = (uint8_t)bank_.tryDeposit(*acc, cents, v); break;
+            case WireOp::Withdraw: st = (uint8_t)bank_.tryWithdraw(*acc, cents, v); break;
+            case WireOp::Transfer: {
+                Account *dest = bank_.findById(to);
+                st = (uint8_t)(dest ? bank_.tryTransfer(*acc, *dest, cents, v) : OpStatus::NoSuchAccount);
+                break;
+            }
+            case WireOp::Logout: bank_.closeSession(token); break;
+        }
+        complete(conn, tag, st, v);
+    }
+
+    // Decodes one frame body and hands it to the engine; false = malformed.
+    bool dispatch(uint64_t key, Conn &c, const char *p, size_t len) {
+        if (len < 5) return false;
+        uint32_t tag; memcpy(&tag, p, 4);
+        WireOp op = (WireOp)p[4];
+        p += 5; len -= 5;
+        int id = 0, to = 0; uint64_t token = 0; int64_t cents = 0;
+        string a, b;
+        auto str = [&](string &s) {
+            if (len < 1 || len - 1 < (size_t)(uint8_t)p[0]) return false;
+            s.assign(p + 1, (uint8_t)p[0]); len -= 1 + s.size(); p += 1 + s.size();
+            return true;
+        };
+        auto num = [&](auto &x) { if (len < sizeof x) return false; memcpy(&x, p, sizeof x); p += sizeof x; len -= sizeof x; return true; };
+        bool ok;
+        switch (op) {
+            case WireOp::Create: ok = str(a) && str(b); break;
+            case WireOp::Login: ok = num(id) && str(a); break;
+            case WireOp::Balance: case WireOp::Logout: ok = num(id) && num(token); break;
+            case WireOp::Deposit: case WireOp::Withdraw: ok = num(id) && num(token) && num(cents); break;
+            case WireOp::Transfer: ok = num(id) && num(token) && num(to) && num(cents); break;
+            default: ok = false;
+        }
+        if (!ok || len != 0) {
+            char r[kWireResponse]; wireResponse(r, tag, kWireBadRequest, 0);
+            c.out.append(r, sizeof r);
+            return true;
+        }
+        ++c.inflight;
+        requests_.fetch_add(1, memory_order_relaxed);
+        auto task = [this, key, tag, op, id, token, to, cents, a = std::move(a), b = std::move(b)] { execute(key, tag, op, id, token, to, cents, a, b); };
+        if (op == WireOp::Create) engine_.post(task); else engine_.post(id, task);
+        return true;
+    }
+
+    // Dispatches every complete frame in c.in, up to the in-flight limit.
+    // Returns false if the connection must be dropped.
+    bool parse(uint64_t key, Conn &c) {
+        if (!c.framed && c.in.size() >= 4 && memcmp(c.in.data(), "GET ", 4) == 0) return scrape(c);
+        size_t pos = 0;
+        bool ok = true;
+        while (c.in.size() - pos >= 4 && c.inflight < kMaxInflight) {
+            uint32_t len; memcpy(&len, &c.in[pos], 4);
+            if (len > kWireMaxFrame) { ok = false; break; }
+            if (c.in.size() - pos - 4 < len) break;
+            dispatch(key, c, &c.in[pos + 4], len);
+            c.framed = true;
+            pos += 4 + len;
+        }
+        c.in.erase(0, pos);
+        return ok;
+    }
+
+    // Waits for the whole request head, then queues the dump and stops
+    // reading; service() closes once it's flushed.
+    bool scrape(Conn &c) {
+        if (c.in.find("\r\n\r\n") == string::npos && c.in.find("\n\n") == string::npos) return !c.eof && c.in.size() <= kWireMaxFrame;
+        string body;
+        formatPrometheus(statsSnapshot(), body);
+        c.out = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + to_string(body.size()) + "\r\n\r\n" + body;
+        c.in.clear();
+        c.eof = true;
+        return true;
+    }
+
+    bool readable(Conn &c) {
+        char buf[1 << 16];
+        while (true) {
+            ssize_t r = ::read(c.fd, buf, sizeof buf);
+            if (r > 0) { c.in.append(buf, (size_t)r); continue; }
+            if (r == 0) { c.eof = true; return true; }
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+    }
+
+    bool flush(Conn &c) {
+        size_t sent = 0;
+        while (sent < c.out.size()) {
+            ssize_t w = ::send(c.fd, c.out.data() + sent, c.out.size() - sent, MSG_NOSIGNAL);
+            if (w > 0) { sent += (size_t)w; continue; }
+            if (w < 0 && errno == EINTR) continue;
+            if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            return false;
+        }
+        c.out.erase(0, sent);
+        return true;
+    }
+
+    // Parses, writes and re-arms one connection; closes it when it's done or broken.
+    void service(uint64_t key, Conn &c, bool ok) {
+        ok = ok && parse(key, c) && flush(c);
+        if (!ok || (c.eof && c.inflight == 0 && c.out.empty())) { // anything left in c.in is a torn frame
+            ::close(c.fd);
+            conns_.erase(key); // late completions for key are dropped
+            return;
+        }
+        uint32_t want = (c.eof || c.inflight >= kMaxInflight ? 0u : (uint32_t)EPOLLIN) | (c.out.empty() ? 0u : (uint32_t)EPOLLOUT);
+        if (want != c.events) { c.events = want; watch(c.fd, key, want, EPOLL_CTL_MOD); }
+    }
+
+    void acceptAll() {
+        while (true) {
+            int fd = ::accept4(listen_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) { if (errno == EINTR) continue; return; }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+            uint64_t key = nextConn_++;
+            Conn &c = conns_[key];
+            c.fd = fd; c.events = EPOLLIN;
+            watch(fd, key, EPOLLIN);
+        }
+    }
+public:
+    BankServer(Bank &bank, RequestEngine &engine) : bank_(bank), engine_(engine) {}
+    BankServer(const BankServer &) = delete;
+    BankServer& operator=(const BankServer &) = delete;
+    ~BankServer() {
+        for (auto &kv : conns_) ::close(kv.second.fd);
+        for (int fd : {listen_, ep_, wake_}) if (fd >= 0) ::close(fd);
+    }
+
+    // Binds 0.0.0.0:port (0 picks a free port; see port()).
+    bool listen(int port) {
+        listen_ = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_ < 0) return false;
+        int one = 1;
+        setsockopt(listen_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+        sockaddr_in addr{}; addr.sin_family = AF_INET; addr.sin_addr.s_addr = htonl(INADDR_ANY); addr.sin_port = htons((uint16_t)port);
+        socklen_t alen = sizeof addr;
+        if (::bind(listen_, (sockaddr *)&addr, sizeof addr) != 0 || ::listen(listen_, 1024) != 0) return false;
+        if (getsockname(listen_, (sockaddr *)&addr, &alen) != 0) return false;
+        port_ = ntohs(addr.sin_port);
+        ep_ = epoll_create1(EPOLL_CLOEXEC);
+        wake_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (ep_ < 0 || wake_ < 0) return false;
+        watch(listen_, kListenKey, EPOLLIN);
+        watch(wake_, kWakeKey, EPOLLIN);
+        return true;
+    }
+    int port() const { return port_; }
+    uint64_t requests() const { return requests_.load(memory_order_relaxed); }
+
+    // Event loop; returns after stop() or once stopFd (e.g. a signalfd) is readable.
+    void run(int stopFd = -1) {
+        if (stopFd >= 0) watch(stopFd, kStopKey, EPOLLIN);
+        epoll_event evs[256];
+        vector<Done> batch;
+        vector<uint64_t> touched;
+        auto lastTick = chrono::steady_clock::now();
+        while (!stop_.load()) {
+            int n = epoll_wait(ep_, evs, 256, 100);
+            if (n < 0) { if (errno == EINTR) continue; break; }
+            if (auto now = chrono::steady_clock::now(); now - lastTick >= chrono::milliseconds(100)) {
+                lastTick = now;
+                engine_.post([this] { bank_.maybeCheckpoint(); }); // the loop thread never blocks on the bank
+            }
+            touched.clear();
+            for (int i = 0; i < n; ++i) {
+                uint64_t key = evs[i].data.u64;
+                if (key == kListenKey) { acceptAll(); continue; }
+                if (key == kStopKey) { stop_ = true; continue; }
+                if (key == kWakeKey) { uint64_t v; ssize_t r = ::read(wake_, &v, 8); (void)r; continue; }
+                auto it = conns_.find(key);
+                if (it == conns_.end()) continue;
+                Conn &c = it->second;
+                bool ok = !(evs[i].events & (EPOLLERR | EPOLLHUP)); // peer gone: nothing left to answer
+                if (ok && (evs[i].events & EPOLLIN)) ok = readable(c);
+                service(key, c, ok);
+            }
+            { lock_guard<mutex> lk(doneMu_); batch.swap(done_); }
+            for (const Done &d : batch) {
+                auto it = conns_.find(d.conn);
+                if (it == conns_.end()) continue;
+                it->second.out.append(d.frame, kWireResponse);
+                --it->second.inflight;
+                touched.push_back(d.conn);
+            }
+            batch.clear();
+            sort(touched.begin(), touched.end());
+            touched.erase(unique(touched.begin(), touched.end()), touched.end());
+            for (uint64_t key : touched) if (auto it = conns_.find(key); it != conns_.end()) service(key, it->second, true);
+        }
+        engine_.wait(); // let in-flight requests finish before the caller checkpoints
+    }
+
+    // Thread-safe (and async-signal-safe).
+    void stop() { stop_ = true; uint64_t one = 1; ssize_t w = ::write(wake_, &one, 8); (void)w; }
+};
+
+// ---------------- CLI helpers ----------------
+static string prompt(const string &msg) { cout << msg; cout.flush(); string s; getline(cin, s); return s; }
+static int promptInt(const string &msg) { while (true) { cout << msg; cout.flush(); string s; getline(cin, s); try { return stoi(s); } catch (...) { cout << "Invalid number. Try again.\n"; } } }
+
+static long long promptAmountCents(const string &msg) { while (true) { string s = prompt(msg); try { return parseAmountCents(s); } catch (const exception &e) { cout << "Invalid amount: " << e.what() << ". Try again.\n"; } } }
+
+// Local midnight starting YYYY-MM-DD, in unix microseconds; false if malformed.
+static bool parseLocalDate(const string &s, int64_t &us) {
+    tm t{};
+    if (sscanf(s.c_str(), "%4d-%2d-%2d", &t.tm_year, &t.tm_mon, &t.tm_mday) != 3) return false;
+    t.tm_year -= 1900; t.tm_mon -= 1; t.tm_isdst = -1;
+    time_t secs = mktime(&t);
+    if (secs == (time_t)-1) return false;
+    us = (int64_t)secs * 1000000;
+    return true;
+}
+
+static void printStatement(const vector<HistoryEntry> &rows) {
+    if (rows.empty()) { cout << "(no transactions)\n"; return; }
+    for (const HistoryEntry &e : rows) {
+        time_t secs = (time_t)(e.timeUs / 1000000);
+        tm t{};
+        localtime_r(&secs, &t);
+        char when[32];
+        strftime(when, sizeof when, "%Y-%m-%d %H:%M:%S", &t);
+        cout << when << "  " << left << setw(14) << kHistoryTypeNames[(size_t)e.type] << right;
+        if (e.counterparty) cout << setw(10) << e.counterparty; else cout << setw(10) << "";
+        char amount[kCentsTextMax];
+        cout << setw(16) << string_view(amount, formatCentsTo(amount, e.cents)) << "\n";
+    }
+}
+
+// ---------------- Script mode ----------------
+// ./bank --script [file|-] [--memory]: runs one operation per line, no
+// prompts:
+//   NEW 1234 Alice Smith   create (PIN, then owner); prints the new ID
+//   DEP 1001 12.34         deposit          WD 1001 5        withdraw
+//   XFER 1001 1002 2.50    transfer         BAL 1001         prints the balance
+//   PIN 1001 5678          change the PIN   LOGIN 1001 1234  check a PIN
+//   ACCRUE 0.0001 -0.25 10 interest/fees on every account (Bank::accrue):
+//                          rate per pass, optional flat amount and minimum
+//                          balance; prints accounts changed, +credited -debited
+// Commands are case-insensitive; blank lines and '#' comments are skipped.
+// Input is read in 1 MB blocks and parsed in place with from_chars; the
+// NEW/BAL output goes through a TextSink, so replaying a file gives the
+// same stdout every time. The summary (ops/sec, errors by kind and the
+// first failing lines) goes to stderr. A script acts as a trusted
+// operator: only LOGIN checks a PIN. --memory runs against an empty bank
+// and saves nothing; otherwise the bank is recovered, logged and saved as
+// in interactive mode.
+struct ScriptStats {
+    static constexpr size_t kParseError = 7, kLoginFailed = 8; // after the OpStatus values
+    size_t ops = 0, errors = 0;
+    array<size_t, 9> byKind{};
+    vector<string> samples; // "line N: what", the first few errors
+    double secs = 0;
+
+    static const char* kindName(size_t k) {
+        return k == kParseError ? "Malformed line" : k == kLoginFailed ? "Wrong PIN" : opStatusMessage((OpStatus)k);
+    }
+};
+
+static void runScriptLine(Bank &bank, string_view line, size_t lineNo, TextSink &out, ScriptStats &st) {
+    size_t pos = 0;
+    auto next = [&] {
+        while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t' || line[pos] == '\r')) ++pos;
+        size_t b = pos;
+        while (pos < line.size() && line[pos] != ' ' && line[pos] != '\t' && line[pos] != '\r') ++pos;
+        return line.substr(b, pos - b);
+    };
+    auto is = [](string_view a, const char *b) {
+        size_t n = strlen(b);
+        if (a.size() != n) return false;
+        for (size_t i = 0; i < n; ++i) if (toupper((unsigned char)a[i]) != b[i]) return false;
+        return true;
+    };
+    auto num = [&](int &v) { string_view t = next(); auto r = from_chars(t.data(), t.data() + t.size(), v); return !t.empty() && r.ec == errc() && r.ptr == t.data() + t.size(); };
+    auto amount = [&](long long &c) { return tryParseAmountCents(next(), c) == AmountError::None; };
+    auto account = [&](int id, Account *&a) { a = bank.findById(id); return a != nullptr; };
+
+    string_view cmd = next();
+    if (cmd.empty() || cmd[0] == '#') return;
+    ++st.ops;
+    size_t kind = (size_t)OpStatus::Ok;
+    int id = 0, to = 0; long long cents = 0, bal = 0;
+    Account *a = nullptr, *b = nullptr;
+    string &buf = out.buffer();
+    char numBuf[16];
+    if (is(cmd, "DEP")) {
+        if (!num(id) || !amount(cents) || !next().empty()) kind = ScriptStats::kParseError;
+        else kind = (size_t)(account(id, a) ? bank.tryDeposit(*a, cents, bal) : OpStatus::NoSuchAccount);
+    } else if (is(cmd, "WD")) {
+        if (!num(id) || !amount(cents) || !next().empty()) kind = ScriptStats::kParseError;
+        else kind = (size_t)(account(id, a) ? bank.tryWithdraw(*a, cents, bal) : OpStatus::NoSuchAccount);
+    } else if (is(cmd, "XFER")) {
+        if (!num(id) || !num(to) || !amount(cents) || !next().empty()) kind = ScriptStats::kParseError;
+        else kind = (size_t)(account(id, a) && account(to, b) ? bank.tryTransfer(*a, *b, cents, bal) : OpStatus::NoSuchAccount);
+    } else if (is(cmd, "BAL")) {
+        if (!num(id) || !next().empty()) kind = ScriptStats::kParseError;
+        else if (!bank.balanceOf(id, bal)) kind = (size_t)OpStatus::NoSuchAccount;
+        else {
+            buf.append(numBuf, to_chars(numBuf, numBuf + sizeof numBuf, id).ptr);
+            buf += ' '; appendCents(buf, bal); buf += '\n';
+        }
+    } else if (is(cmd, "PIN")) {
+        string_view pin;
+        if (!num(id) || (pin = next()).empty() || !next().empty()) kind = ScriptStats::kParseError;
+        else kind = (size_t)(account(id, a) ? bank.trySetPin(*a, string(pin)) : OpStatus::NoSuchAccount);
+    } else if (is(cmd, "LOGIN")) {
+        string_view pin;
+        if (!num(id) || (pin = next()).empty() || !next().empty()) kind = ScriptStats::kParseError;
+        else if (!bank.findById(id)) kind = (size_t)OpStatus::NoSuchAccount;
+        else if (!bank.login(id, string(pin))) kind = ScriptStats::kLoginFailed;
+    } else if (is(cmd, "ACCRUE")) {
+        AccrualRule rule;
+        string_view t = next(), f = next(), m = next();
+        if (tryParseAmountMinor<8>(t, rule.rateE8) != AmountError::None || llabs(rule.rateE8) > kAccrualRateMax
+            || (!f.empty() && tryParseAmountCents(f, rule.flatCents) != AmountError::None)
+            || (!m.empty() && tryParseAmountCents(m, rule.minBalanceCents) != AmountError::None) || !next().empty())
+            kind = ScriptStats::kParseError;
+        else {
+            AccrualResult r = bank.accrue(rule);
+            buf += "ACCRUE "; buf += to_string(r.accounts); buf += " +"; appendCents(buf, r.creditedCents);
+            buf += " -"; appendCents(buf, r.debitedCents); buf += '\n';
+        }
+    } else if (is(cmd, "NEW")) {
+        string pin(next());
+        while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t')) ++pos;
+        string_view owner = line.substr(pos);
+        while (!owner.empty() && (owner.back() == '\r' || owner.back() == ' ' || owner.back() == '\t')) owner.remove_suffix(1);
+        if (pin.empty()) kind = ScriptStats::kParseError;
+        else if (!validPin(pin)) kind = (size_t)OpStatus::InvalidPin;
+        else if (owner.size() > kMaxOwnerBytes) kind = ScriptStats::kParseError;
+        else {
+            buf.append(numBuf, to_chars(numBuf, numBuf + sizeof numBuf, bank.createAccount(string(owner), pin)).ptr);
+            buf += '\n';
+        }
+    } else {
+        kind = ScriptStats::kParseError;
+    }
+    out.maybeFlush();
+    if (kind == (size_t)OpStatus::Ok) return;
+    ++st.errors; ++st.byKind[kind];
+    if (st.samples.size() < 10) st.samples.push_back("line " + to_string(lineNo) + ": " + ScriptStats::kindName(kind));
+}
+
+static ScriptStats runScript(Bank &bank, istream &in, TextSink &out) {
+    ScriptStats st;
+    auto t0 = chrono::steady_clock::now();
+    vector<char> buf(1 << 20);
+    size_t have = 0, lineNo = 0;
+    while (true) {
+        if (have == buf.size()) buf.resize(buf.size() * 2); // line longer than the buffer
+        in.read(buf.data() + have, (streamsize)(buf.size() - have));
+        size_t len = have + (size_t)in.gcount();
+        if (len == have) { if (have) runScriptLine(bank, string_view(buf.data(), have), ++lineNo, out, st); break; }
+        const char *p = buf.data(), *end = buf.data() + len;
+        while (const char *nl = (const char *)memchr(p, '\n', (size_t)(end - p))) {
+            runScriptLine(bank, string_view(p, (size_t)(nl - p)), ++lineNo, out, st);
+            p = nl + 1;
+        }
+        bank.maybeCheckpoint();
+        have = (size_t)(end - p);
+        memmove(buf.data(), p, have);
+    }
+    out.flush();
+    st.secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    return st;
+}
+
+static void printScriptSummary(const ScriptStats &st, ostream &os) {
+    os << "script: " << st.ops << " ops in " << fixed << setprecision(3) << st.secs << " s ("
+       << setprecision(0) << (st.secs > 0 ? (double)st.ops / st.secs : 0) << " ops/s), " << st.errors << " errors\n";
+    for (size_t k = 1; k < st.byKind.size(); ++k) if (st.byKind[k]) os << "  " << ScriptStats::kindName(k) << ": " << st.byKind[k] << "\n";
+    for (const string &s : st.samples) os << "  " << s << "\n";
+}
+
+static int scriptMode(Bank &bank, const string &path) {
+    ifstream file;
+    if (path != "-") {
+        file.open(path, ios::binary);
+        if (!file) { cerr << "Cannot open " << path << "\n"; return 1; }
+    }
+    istream &in = path == "-" ? cin : file;
+    TextSink out(cout, 1 << 20);
+    ScriptStats st = runScript(bank, in, out);
+    cout.flush();
+    printScriptSummary(st, cerr);
+    return 0;
+}
+
+// ---------------- Benchmarks ----------------
+// Quick in-binary micro-benchmarks:
+//   ./bank --bench [N] [--json FILE] [--filter GROUP]
+// Each bench prints ns/op; a checksum is folded into g_benchSink so the
+// optimizer can't drop the timed loop. --json also writes every result as
+// one JSON object per line (after a "meta" line describing the run), and
+//   ./bank --bench-compare BASE.jsonl NEW.jsonl [PCT]
+// lists results that got more than PCT% (default 10) slower, exiting 1 if
+// any did, so releases can be checked for regressions.
+static volatile long long g_benchSink = 0;
+static ofstream g_benchJson;   // open when --json was given
+static string g_benchGroup;    // group of the bench now running
+
+template <class F> static double benchSeconds(F &&f) {
+    auto t0 = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+}
+
+static string jsonQuote(const string &s) {
+    string q = "\"";
+    for (char c : s) { if (c == '"' || c == '\\') q += '\\'; q += c; }
+    return q + '"';
+}
+
+static void benchReport(const string &name, size_t ops, double secs) {
+    cout << left << setw(36) << name << right << setw(12) << fixed << setprecision(1)
+         << (secs * 1e9 / (double)ops) << " ns/op" << setw(14) << (size_t)((double)ops / secs) << " ops/s\n";
+    if (g_benchJson.is_open())
+        g_benchJson << "{\"group\":" << jsonQuote(g_benchGroup) << ",\"name\":" << jsonQuote(name) << ",\"ops\":" << ops
+                    << fixed << setprecision(2) << ",\"ns_per_op\":" << secs * 1e9 / (double)ops
+                    << setprecision(0) << ",\"ops_per_sec\":" << (double)ops / secs << "}\n";
+}
+
+// Reads the name -> ns_per_op pairs of a --json file.
+static bool readBenchJson(const string &path, vector<pair<string, double>> &out) {
+    ifstream in(path);
+    if (!in) return false;
+    for (string line; getline(in, line);) {
+        size_t n = line.find("\"name\":\""), v = line.find("\"ns_per_op\":");
+        if (n == string::npos || v == string::npos) continue;
+        string name;
+        for (size_t i = n + 8; i < line.size() && line[i] != '"'; ++i) { if (line[i] == '\\' && i + 1 < line.size()) ++i; name += line[i]; }
+        out.push_back({name, atof(line.c_str() + v + 12)});
+    }
+    return true;
+}
+
+static int compareBenchmarks(const string &basePath, const string &newPath, double pct) {
+    vector<pair<string, double>> base, cur;
+    if (!readBenchJson(basePath, base) || !readBenchJson(newPath, cur)) { cerr << "Cannot read benchmark results\n"; return 2; }
+    unordered_map<string, double> was(base.begin(), base.end());
+    size_t regressions = 0, compared = 0;
+    for (auto &[name, ns] : cur) {
+        auto it = was.find(name);
+        if (it == was.end() || it->second <= 0) continue;
+        ++compared;
+        double change = (ns / it->second - 1) * 100;
+        if (change <= pct) continue;
+        ++regressions;
+        cout << left << setw(44) << name << right << fixed << setprecision(1) << setw(12) << it->second << " -> "
+             << setw(10) << ns << " ns/op  (+" << change << "%)\n";
+    }
+    cout << compared << " results compared, " << regressions << " slower by more than " << pct << "%\n";
+    return regressions ? 1 : 0;
+}
+
+// Salt source and onboarding throughput: the old random_device +
+// mt19937_64 per salt vs the pooled CSPRNG, and createAccount in a loop vs
+// createAccounts.
+static size_t legacyMakeSalt() {
+    random_device rd; mt19937_64 gen(rd()); uniform_int_distribution<size_t> dist;
+    return dist(gen);
+}
+
+static void benchOnboarding(size_t n) {
+    const size_t saltOps = 200000;
+    double t = benchSeconds([&] { size_t x = 0; for (size_t i = 0; i < saltOps; ++i) x ^= legacyMakeSalt(); g_benchSink += (long long)(x & 1); });
+    benchReport("salt/random_device+mt19937_64", saltOps, t);
+    t = benchSeconds([&] { size_t x = 0; for (size_t i = 0; i < saltOps; ++i) x ^= makeSalt(); g_benchSink += (long long)(x & 1); });
+    benchReport("salt/pooled-getentropy", saltOps, t);
+
+    n = max<size_t>(n, 100000);
+    vector<Bank::NewAccount> batch(n, {"bench", "1234"});
+    {
+        Bank bank;
+        t = benchSeconds([&] { for (size_t i = 0; i < n; ++i) bank.createAccount("bench", "1234"); });
+        benchReport("createAccount/loop n=" + to_string(n), n, t);
+    }
+    Bank bank;
+    vector<int> ids;
+    t = benchSeconds([&] { ids = bank.createAccounts(batch); });
+    benchReport("createAccounts/bulk n=" + to_string(n), n, t);
+    if (ids.size() != n || ids.back() != 1000 + (int)n || !bank.login(ids[n / 2], "1234")) cout << "  BULK CREATE MISMATCH\n";
+}
+
+static void benchLookup(size_t n) {
+    // Old layout: vector<Account> + linear scan, as findById used to do.
+    vector<Account> flat; flat.reserve(n);
+    Bank bank;
+    for (size_t i = 0; i < n; ++i) {
+        int id = bank.createAccount("bench", "1234");
+        flat.emplace_back(id, "bench", "1234");
+    }
+    mt19937 rng(42);
+    uniform_int_distribution<int> pick(1001, 1001 + (int)n - 1);
+    const size_t scanOps = max<size_t>(1, min<size_t>(2000, 200000000 / n)), idxOps = 5000000;
+    vector<int> ids(idxOps); for (auto &id : ids) id = pick(rng);
+
+    double t = benchSeconds([&] {
+        long long sum = 0;
+        for (size_t i = 0; i < scanOps; ++i)
+            for (auto &a : flat) if (a.id() == ids[i]) { sum += a.id(); break; }
+        g_benchSink += sum;
+    });
+    benchReport("findById/linear-scan n=" + to_string(n), scanOps, t);
+
+    t = benchSeconds([&] {
+        long long sum = 0;
+        for (size_t i = 0; i < idxOps; ++i) sum += bank.findById(ids[i])->id();
+        g_benchSink += sum;
+    });
+    benchReport("findById/index n=" + to_string(n), idxOps, t);
+
+    t = benchSeconds([&] {
+        long long sum = 0;
+        for (size_t i = 0; i < idxOps / 10; ++i) sum += bank.login(ids[i], "1234") != nullptr;
+        g_benchSink += sum;
+    });
+    benchReport("login/index n=" + to_string(n), idxOps / 10, t);
+}
+
+static void benchColumnar(size_t n) {
+    // Same data in the row layout (vector<Account>) and in ColumnarBank.
+    vector<Account> rows; rows.reserve(n);
+    ColumnarBank cols; cols.reserve(n);
+    mt19937_64 rng(7);
+    uniform_int_distribution<long long> amt(1, 1000000);
+    for (size_t i = 0; i < n; ++i) {
+        int id = cols.createAccount("bench", "1234");
+        rows.emplace_back(id, "bench", "1234");
+        long long c = amt(rng);
+        cols.deposit(id, c); rows.back().deposit(c);
+    }
+    const int reps = 20;
+    const long long threshold = 500000;
+
+    double t = benchSeconds([&] {
+        for (int r = 0; r < reps; ++r) {
+            long long sum = 0;
+            for (auto &a : rows) sum += a.balanceCents();
+            g_benchSink += sum;
+        }
+    });
+    benchReport("total/rows n=" + to_string(n), n * reps, t);
+    t = benchSeconds([&] { for (int r = 0; r < reps; ++r) g_benchSink += cols.totalCents(); });
+    benchReport("total/columnar n=" + to_string(n), n * reps, t);
+
+    t = benchSeconds([&] {
+        for (int r = 0; r < reps; ++r) {
+            size_t c = 0;
+            for (auto &a : rows) c += a.balanceCents() < threshold;
+            g_benchSink += (long long)c;
+        }
+    });
+    benchReport("countBelow/rows n=" + to_string(n), n * reps, t);
+    t = benchSeconds([&] { for (int r = 0; r < reps; ++r) g_benchSink += (long long)cols.countBelow(threshold); });
+    benchReport("countBelow/columnar n=" + to_string(n), n * reps, t);
+
+    t = benchSeconds([&] {
+        for (int r = 0; r < reps; ++r) {
+            vector<const Account*> v; v.reserve(rows.size());
+            for (auto &a : rows) v.push_back(&a);
+            partial_sort(v.begin(), v.begin() + min<size_t>(10, v.size()), v.end(),
+                         [](const Account *a, const Account *b) { return a->balanceCents() > b->balanceCents(); });
+            g_benchSink += v.empty() ? 0 : v[0]->id();
+        }
+    });
+    benchReport("top10/rows n=" + to_string(n), n * reps, t);
+    t = benchSeconds([&] {
+        for (int r = 0; r < reps; ++r) { auto top = cols.topByBalance(10); g_benchSink += top.empty() ? 0 : top[0].first; }
+    });
+    benchReport("top10/columnar n=" + to_string(n), n * reps, t);
+}
+
+static bool checkKernels() {
+    // All paths must agree exactly: odd lengths for the tails, extreme values
+    // for the compare/wrap cases.
+    mt19937_64 rng(99);
+    vector<long long> v(100003);
+    for (auto &x : v) x = (long long)rng() >> (rng() % 40);
+    v[5] = LLONG_MIN; v[77] = LLONG_MAX; v[100002] = -1;
+    const vector<long long> edges{LLONG_MIN + 1, -1000000, 0, 1, 1000000, LLONG_MAX};
+    const long long probes[] = {LLONG_MIN, -1, 0, 1, 12345, LLONG_MAX};
+    bool ok = true;
+    auto all = availableKernels();
+    for (size_t len : {size_t(0), size_t(1), size_t(3), size_t(7), size_t(4097), v.size()}) {
+        for (auto *k : all) {
+            const BalanceKernels &ref = kScalarKernels;
+            long long a, b, c, d;
+            k->minMax(v.data(), len, a, b); ref.minMax(v.data(), len, c, d);
+            ok &= k->sum(v.data(), len) == ref.sum(v.data(), len) && a == c && b == d;
+            for (long long p : probes) ok &= k->countBelow(v.data(), len, p) == ref.countBelow(v.data(), len, p);
+            ok &= balanceHistogram(*k, v.data(), len, edges) == balanceHistogram(ref, v.data(), len, edges);
+            if (!ok) { cout << "KERNEL MISMATCH: " << k->name << " len=" << len << "\n"; return false; }
+        }
+    }
+    return ok;
+}
+
+static void benchKernels(size_t n) {
+    mt19937_64 rng(3);
+    vector<long long> v(n);
+    for (auto &x : v) x = (long long)(rng() % 2000000) - 100000;
+    const vector<long long> edges{0, 10000, 100000, 1000000};
+    const int reps = 50;
+    cout << "kernels: selected=" << balanceKernels().name << (checkKernels() ? ", all paths match\n" : "\n");
+    for (auto *k : availableKernels()) {
+        string tag = string("/") + k->name + " n=" + to_string(n);
+        double t = benchSeconds([&] { for (int r = 0; r < reps; ++r) g_benchSink += k->sum(v.data(), v.size()); });
+        benchReport("kernel.sum" + tag, n * reps, t);
+        t = benchSeconds([&] { for (int r = 0; r < reps; ++r) g_benchSink += (long long)k->countBelow(v.data(), v.size(), 0); });
+        benchReport("kernel.countBelow" + tag, n * reps, t);
+        t = benchSeconds([&] {
+            for (int r = 0; r < reps; ++r) { long long a, b; k->minMax(v.data(), v.size(), a, b); g_benchSink += a ^ b; }
+        });
+        benchReport("kernel.minMax" + tag, n * reps, t);
+        t = benchSeconds([&] { for (int r = 0; r < reps; ++r) g_benchSink += (long long)balanceHistogram(*k, v.data(), v.size(), edges)[0]; });
+        benchReport("kernel.histogram4" + tag, n * reps, t);
+    }
+}
+
+// The original string/stoll parser, kept as the reference for checkParser.
+// Note it negated cents twice, so "-0.50" came out as +50 and "-1.50" as -50.
+static long long legacyParseAmountCents(const string &s) {
     // Accepts formats like "123", "123.45", "0.99"; ignores leading/trailing spaces
     string t; for (char c : s) if (!isspace((unsigned char)c)) t.push_back(c);
     if (t.empty()) throw invalid_argument("empty amount");
@@ -47,145 +4280,1588 @@ static long long parseAmountCents(const string &s) {
     return dollars * 100LL + (t[0] == '-' ? -cents : cents);
 }
 
-static string formatCents(long long cents) {
+// Fuzz-equivalence: on well-formed input that the legacy parser accepts,
+// the new one must agree, except that negative amounts come back as the
+// negation of the unsigned amount (the legacy sign bug, fixed). On junk,
+// whatever the new parser accepts the legacy one must accept identically.
+static bool checkParser() {
+    mt19937 rng(5);
+    const string alphabet = "0123456789.-+ x";
+    auto wellFormed = [](const string &t) {
+        size_t i = 0, n = t.size(); bool digit = false;
+        while (i < n && t[i] == ' ') ++i;
+        if (i < n && (t[i] == '-' || t[i] == '+')) ++i;
+        while (i < n && isdigit((unsigned char)t[i])) ++i, digit = true;
+        if (i < n && t[i] == '.') { ++i; while (i < n && isdigit((unsigned char)t[i])) ++i, digit = true; }
+        while (i < n && t[i] == ' ') ++i;
+        return digit && i == n;
+    };
+    for (int iter = 0; iter < 200000; ++iter) {
+        string t;
+        if (iter & 1) {        // structured: [ ][sign]d{0,12}[.d{0,4}][ ]
+            if (rng() % 4 == 0) t += ' ';
+            int sg = rng() % 3; if (sg == 1) t += '-'; else if (sg == 2) t += '+';
+            for (int k = rng() % 13; k > 0; --k) t += char('0' + rng() % 10);
+            if (rng() % 2) { t += '.'; for (int k = rng() % 5; k > 0; --k) t += char('0' + rng() % 10); }
+            if (rng() % 4 == 0) t += ' ';
+        } else {               // noise
+            for (int k = rng() % 10; k > 0; --k) t += alphabet[rng() % alphabet.size()];
+        }
+        long long got = 0;
+        AmountError e = tryParseAmountCents(t, got);
+        bool legacyOk = true; long long want = 0;
+        try { want = legacyParseAmountCents(t); } catch (...) { legacyOk = false; }
+        if (wellFormed(t)) {
+            // Compare on the unsigned part; legacy rejects a bare sign before
+            // the dot ("-.5"), which the new parser accepts.
+            size_t sp = t.find_first_not_of(' ');
+            string u = t; bool neg = u[sp] == '-';
+            if (u[sp] == '-' || u[sp] == '+') u[sp] = ' ';
+            try { want = legacyParseAmountCents(u); } catch (...) { continue; }
+            if (neg) want = -want;
+            if (e != AmountError::None || got != want) { cout << "PARSER MISMATCH on \"" << t << "\"\n"; return false; }
+        } else if (e == AmountError::None && (!legacyOk || got != want)) {
+            cout << "PARSER MISMATCH on \"" << t << "\"\n"; return false;
+        }
+    }
+    long long v = 0;
+    return tryParseAmountCents("-0.50", v) == AmountError::None && v == -50
+        && tryParseAmountCents("-1.50", v) == AmountError::None && v == -150
+        && tryParseAmountCents("99999999999999999999", v) == AmountError::OutOfRange
+        && tryParseAmountCents("  ", v) == AmountError::Empty
+        && tryParseAmountCents("1.2.3", v) == AmountError::Invalid;
+}
+
+static void benchParser() {
+    mt19937 rng(11);
+    vector<string> amounts(1 << 16);
+    for (auto &a : amounts) a = to_string(rng() % 100000) + "." + to_string(10 + rng() % 90);
+    cout << "parser: " << (checkParser() ? "fuzz-equivalent to legacy\n" : "FAILED equivalence\n");
+    const size_t ops = 4000000;
+    double t = benchSeconds([&] {
+        long long sum = 0;
+        for (size_t i = 0; i < ops; ++i) sum += legacyParseAmountCents(amounts[i & 0xFFFF]);
+        g_benchSink += sum;
+    });
+    benchReport("parseAmountCents/legacy", ops, t);
+    t = benchSeconds([&] {
+        long long sum = 0, c = 0;
+        for (size_t i = 0; i < ops; ++i) if (tryParseAmountCents(amounts[i & 0xFFFF], c) == AmountError::None) sum += c;
+        g_benchSink += sum;
+    });
+    benchReport("parseAmountCents/from_chars", ops, t);
+}
+
+// The original ostringstream formatter, reference for checkFormat.
+static string legacyFormatCents(long long cents) {
     bool neg = cents < 0; if (neg) cents = -cents;
     long long dollars = cents / 100; long long rem = cents % 100;
     ostringstream oss; oss << (neg ? "-" : "") << "$" << dollars << "." << setw(2) << setfill('0') << rem;
     return oss.str();
 }
 
-// ---------------- Simple hash (demo only) ----------------
-static size_t hashPin(const string &pin, size_t salt) {
-    // WARNING: This is NOT cryptographically secure; for learning purposes only.
-    // Combines std::hash with a per-account salt.
-    return std::hash<string>{}(pin + to_string(salt)) ^ (salt << 1);
+static bool checkFormat() {
+    mt19937_64 rng(13);
+    for (int i = 0; i < 200000; ++i) {
+        long long v = (long long)rng() >> (rng() % 64);
+        if (v == LLONG_MIN) continue; // legacy negates it (UB)
+        if (formatCents(v) != legacyFormatCents(v)) { cout << "FORMAT MISMATCH on " << v << "\n"; return false; }
+    }
+    for (long long v : {0LL, 1LL, -1LL, 99LL, -100LL, 100LL, LLONG_MAX, LLONG_MIN + 1})
+        if (formatCents(v) != legacyFormatCents(v)) { cout << "FORMAT MISMATCH on " << v << "\n"; return false; }
+    return true;
 }
 
-// ---------------- Account class ----------------
-class Account {
-    int id_;
-    string owner_;
-    long long balanceCents_ = 0;  // store as cents
-    size_t salt_ = 0;
-    size_t pinHash_ = 0;
-public:
-    friend class bank;
+static void benchFormat() {
+    mt19937_64 rng(17);
+    vector<long long> v(1 << 16);
+    for (auto &x : v) x = (long long)(rng() % 100000000) - 1000000;
+    cout << "format: " << (checkFormat() ? "byte-identical to legacy\n" : "FAILED equivalence\n");
+    const size_t ops = 4000000;
+    double t = benchSeconds([&] {
+        size_t len = 0;
+        for (size_t i = 0; i < ops; ++i) len += legacyFormatCents(v[i & 0xFFFF]).size();
+        g_benchSink += (long long)len;
+    });
+    benchReport("formatCents/ostringstream", ops, t);
+    t = benchSeconds([&] {
+        size_t len = 0; char buf[kCentsTextMax];
+        for (size_t i = 0; i < ops; ++i) len += formatCentsTo(buf, v[i & 0xFFFF]);
+        g_benchSink += (long long)len;
+    });
+    benchReport("formatCentsTo/buffer", ops, t);
+    t = benchSeconds([&] {
+        string out;
+        for (size_t i = 0; i < ops; ++i) { if ((i & 1023) == 0) out.clear(); appendCents(out, v[i & 0xFFFF]); }
+        g_benchSink += (long long)out.size();
+    });
+    benchReport("appendCents/reused-string", ops, t);
+}
 
-    Account(int id, string owner, const string &pin)
-        : id_(id), owner_(std::move(owner)) {
-        // random-ish salt
-        random_device rd; mt19937_64 gen(rd()); uniform_int_distribution<size_t> dist;
-        salt_ = dist(gen);
-        setPin(pin);
+// Money<C> formatting/parsing per currency, batched FX conversion, and the
+// balance limit on every credit path.
+static void benchMoney() {
+    bool ok = true;
+    char buf[kMoneyTextMax];
+    auto fmt = [&](auto m) { return string(buf, m.formatTo(buf)); };
+    ok &= fmt(Money<USD>::fromMinor(-5)) == "-$0.05" && fmt(Money<JPY>::fromMinor(1234)) == "¥1234"
+       && fmt(Money<KWD>::fromMinor(12345)) == "KD 12.345" && fmt(Money<EUR>::fromMinor(100)) == "€1.00";
+    Money<KWD> kwd; Money<JPY> jpy;
+    ok &= Money<KWD>::tryParse("1.5", kwd) == AmountError::None && kwd.minor() == 1500;
+    ok &= Money<JPY>::tryParse("99.9", jpy) == AmountError::None && jpy.minor() == 99;
+    Money<USD> sum;
+    ok &= !Money<USD>::tryAdd(Money<USD>::fromMinor(LLONG_MAX), Money<USD>::fromMinor(1), sum);
+    // Half away from zero: 0.125 KWD -> 0.13 EUR at 1.0 (-0.125 -> -0.13); 1 US cent at 150 JPY/USD is 1.5 -> 2 yen.
+    Money<EUR> e;
+    ok &= FxRate<USD, EUR>{100000000}.tryConvert(Money<USD>::fromMinor(12), e) && e.minor() == 12;
+    ok &= FxRate<KWD, EUR>{100000000}.tryConvert(Money<KWD>::fromMinor(125), e) && e.minor() == 13;
+    ok &= FxRate<KWD, EUR>{100000000}.tryConvert(Money<KWD>::fromMinor(-125), e) && e.minor() == -13;
+    ok &= FxRate<USD, JPY>{15000000000}.tryConvert(Money<USD>::fromMinor(1), jpy) && jpy.minor() == 2;
+    ok &= !FxRate<USD, JPY>{15000000000}.tryConvert(Money<USD>::fromMinor(LLONG_MAX), jpy);
+    // Largest parseable rate on the largest amount: past even 128 bits, refused.
+    FxRate<USD, KWD> huge{};
+    Money<KWD> kw = Money<KWD>::fromMinor(7);
+    ok &= FxRate<USD, KWD>::tryParse("92233720368.54775807", huge) == AmountError::None && huge.e8 == LLONG_MAX;
+    ok &= !huge.tryConvert(Money<USD>::fromMinor(LLONG_MAX), kw) && kw.minor() == 7;
+    ok &= !huge.tryConvert(Money<USD>::fromMinor(-LLONG_MAX), kw) && kw.minor() == 7;
+    cout << "money: " << (ok ? "formatting, parsing and rounding as expected\n" : "MONEY MISMATCH\n");
+
+    const size_t ops = 4000000;
+    mt19937_64 rng(23);
+    vector<Money<USD>> usd(1 << 16);
+    for (auto &m : usd) m = Money<USD>::fromMinor((long long)(rng() % 100000000));
+    vector<Money<EUR>> eur(usd.size());
+    const FxRate<USD, EUR> rate{92150000};
+    double t = benchSeconds([&] {
+        for (size_t done = 0; done < ops; done += usd.size()) if (fxConvert(usd.data(), usd.size(), rate, eur.data()) != usd.size()) cout << "  FX OVERFLOW\n";
+        g_benchSink += eur[7].minor();
+    });
+    benchReport("fxConvert/USD->EUR", ops, t);
+    long long worst = 0;
+    vector<Money<USD>> back(usd.size());
+    fxConvert(eur.data(), eur.size(), rate.inverse(), back.data());
+    for (size_t i = 0; i < usd.size(); ++i) worst = max(worst, llabs(back[i].minor() - usd[i].minor()));
+    cout << "  USD->EUR->USD round trip: worst drift " << worst << " cents\n";
+    t = benchSeconds([&] {
+        size_t len = 0;
+        for (size_t i = 0; i < ops; ++i) len += eur[i & 0xFFFF].formatTo(buf);
+        g_benchSink += (long long)len;
+    });
+    benchReport("Money<EUR>::formatTo", ops, t);
+
+    for (BalanceMode mode : {BalanceMode::Locked, BalanceMode::Atomic}) {
+        Bank bank(mode);
+        Account &a = *bank.findById(bank.createAccount("full", "1234")), &b = *bank.findById(bank.createAccount("other", "1234"));
+        long long bal = 0;
+        bool limit = bank.tryDeposit(a, kMaxBalanceCents, bal) == OpStatus::Ok && bank.tryDeposit(a, 1, bal) == OpStatus::BalanceLimit;
+        limit &= bank.tryDeposit(b, 100, bal) == OpStatus::Ok && bank.tryTransfer(b, a, 50, bal) == OpStatus::BalanceLimit && b.balanceCents() == 100;
+        BatchOp batch[] = {{BatchOp::Kind::Deposit, a.id(), 1}, {BatchOp::Kind::Transfer, b.id(), 7, a.id()}};
+        vector<OpStatus> st = bank.applyBatch(batch, 2);
+        limit &= st[0] == OpStatus::BalanceLimit && st[1] == OpStatus::BalanceLimit && a.balanceCents() == kMaxBalanceCents && b.balanceCents() == 100;
+        limit &= bank.tryDepositIn(b, Money<JPY>::fromMinor(1000), FxRate<JPY, USD>{666667}, bal) == OpStatus::Ok && bal == 100 + 667;
+        if (!limit) cout << "  BALANCE LIMIT MISMATCH (" << (mode == BalanceMode::Atomic ? "atomic" : "locked") << ")\n";
     }
+}
 
-    int id() const { return id_; }
-    const string& owner() const { return owner_; }
-    long long balanceCents() const { return balanceCents_; }
+static void benchPersistence(size_t n) {
+    Bank bank;
+    for (size_t i = 0; i < n; ++i) bank.findById(bank.createAccount("Owner " + to_string(i % 5000), "1234"))->deposit(1 + (long long)i);
+    const string path = "bench_accounts.tsv";
+    double t = benchSeconds([&] { if (!bank.saveToFile(path)) cout << "save failed\n"; });
+    ifstream f(path, ios::binary | ios::ate);
+    double mb = (double)f.tellg() / 1e6;
+    benchReport("saveToFile n=" + to_string(n), n, t);
+    cout << "  " << fixed << setprecision(1) << mb / t << " MB/s written (" << mb << " MB)\n";
+    Bank loaded;
+    t = benchSeconds([&] { loaded.loadFromFile(path); });
+    benchReport("loadFromFile n=" + to_string(n), n, t);
+    cout << "  " << mb / t << " MB/s parsed, " << loaded.size() << " accounts\n";
+    if (loaded.size() != n || !loaded.login(1001, "1234") || loaded.findById(1000 + (int)n)->balanceCents() != (long long)n)
+        cout << "  ROUND-TRIP MISMATCH\n";
+    std::remove(path.c_str());
+}
 
-    bool verifyPin(const string &pin) const { return hashPin(pin, salt_) == pinHash_; }
+static void benchSnapshot(size_t n) {
+    const string tsv = "bench_accounts.tsv", snap = "bench_accounts.snap";
+    {
+        Bank bank;
+        for (size_t i = 0; i < n; ++i) bank.findById(bank.createAccount("Owner " + to_string(i % 5000), "1234"))->deposit(1 + (long long)i);
+        bank.saveToFile(tsv);
+        double t = benchSeconds([&] { if (!bank.saveSnapshot(snap)) cout << "snapshot save failed\n"; });
+        benchReport("saveSnapshot n=" + to_string(n), n, t);
+    }
+    Bank fromTsv, fromSnap;
+    double t = benchSeconds([&] { fromTsv.loadFromFile(tsv); });
+    cout << "  startup/tsv-load       " << fixed << setprecision(3) << t * 1e3 << " ms\n";
+    t = benchSeconds([&] { if (!fromSnap.openSnapshot(snap)) cout << "snapshot open failed\n"; });
+    cout << "  startup/snapshot-mmap  " << t * 1e3 << " ms\n";
+    t = benchSeconds([&] { if (!fromSnap.verifySnapshot()) cout << "snapshot checksum mismatch\n"; });
+    cout << "  snapshot verify        " << t * 1e3 << " ms\n";
+    mt19937 rng(21);
+    uniform_int_distribution<int> pick(1001, 1000 + (int)n);
+    const size_t ops = min<size_t>(n, 1000000);
+    t = benchSeconds([&] {
+        long long sum = 0, c = 0;
+        for (size_t i = 0; i < ops; ++i) if (fromSnap.balanceOf(pick(rng), c)) sum += c;
+        g_benchSink += sum;
+    });
+    benchReport("balanceOf/mapped n=" + to_string(n), ops, t);
+    long long a = 0, b = 0;
+    if (fromSnap.size() != n || !fromSnap.login(1001, "1234") || !fromSnap.balanceOf(1000 + (int)n, a)
+        || !fromTsv.balanceOf(1000 + (int)n, b) || a != b || fromSnap.size() != n)
+        cout << "  SNAPSHOT MISMATCH\n";
+    std::remove(tsv.c_str()); std::remove(snap.c_str());
+}
 
-    void setPin(const string &pin) {
-        if (pin.size() < 4 || pin.size() > 12 || !all_of(pin.begin(), pin.end(), ::isdigit))
-            throw invalid_argument("PIN must be 4-12 digits");
-        pinHash_ = hashPin(pin, salt_);
+static void benchWal() {
+    const string wal = "bench_accounts.wal", snap = "bench_accounts.snap", tsv = "bench_accounts.tsv";
+    struct Level { WalOptions opt; size_t ops; } levels[] = {
+        {{WalOptions::Sync::None, 64, 5}, 500000},
+        {{WalOptions::Sync::Group, 64, 5}, 200000},
+        {{WalOptions::Sync::Group, 1024, 20}, 200000},
+        {{WalOptions::Sync::Always, 1, 0}, 5000},
+    };
+    for (auto &lv : levels) {
+        std::remove(wal.c_str());
+        long long expect = 0;
+        {
+            Bank bank;
+            int id = bank.createAccount("bench", "1234");
+            Account &a = *bank.findById(id);
+            if (!bank.attachWal(wal, lv.opt)) { cout << "wal open failed\n"; return; }
+            double t = benchSeconds([&] {
+                for (size_t i = 0; i < lv.ops; ++i) bank.deposit(a, 1 + (long long)(i & 7));
+                bank.syncWal();
+            });
+            expect = a.balanceCents();
+            string name = string("wal.deposit/") + walSyncName(lv.opt.sync);
+            if (lv.opt.sync == WalOptions::Sync::Group) name += "(" + to_string(lv.opt.groupRecords) + "rec," + to_string(lv.opt.groupMs) + "ms)";
+            benchReport(name, lv.ops, t);
+        }
+        // Replay check: the account itself was created before the log was attached.
+        Bank rec;
+        rec.createAccount("bench", "1234");
+        long long got = 0;
+        double t = benchSeconds([&] { rec.recover(snap, tsv, wal); });
+        rec.balanceOf(1001, got);
+        if (got != expect) cout << "  WAL REPLAY MISMATCH (" << got << " vs " << expect << ")\n";
+        else if (lv.opt.sync == WalOptions::Sync::None) benchReport("wal.replay", lv.ops, t);
     }
+    std::remove(wal.c_str());
+}
 
-    void deposit(long long cents) {
-        if (cents <= 0) throw invalid_argument("Deposit must be positive");
-        balanceCents_ += cents;
+// Sorted-latency percentile helper for the latency benches.
+static double percentileNs(vector<double> &v, double p) {
+    if (v.empty()) return 0;
+    size_t k = min(v.size() - 1, (size_t)(p * (double)v.size()));
+    nth_element(v.begin(), v.begin() + (ptrdiff_t)k, v.end());
+    return v[k];
+}
+
+// Load generator for the network server:
+//   ./bank --loadgen [host:]port [connections] [seconds] [pipeline]
+// One thread per connection. Each creates and logs into its own account,
+// funds it, then keeps `pipeline` requests in flight (40% deposit, 30%
+// withdraw, 20% balance, 10% transfer to another connection's account)
+// until time is up. Latency is send-to-response per request.
+struct LoadgenResult {
+    size_t requests = 0, failed = 0; // failed: no session / bad request / transport error
+    double secs = 0, p50 = 0, p99 = 0, p999 = 0;
+    long long netCents = 0;          // sum of accepted deposits minus withdrawals
+};
+
+static int wireConnect(const string &host, int port) {
+    addrinfo hints{}, *res = nullptr;
+    hints.ai_family = AF_UNSPEC; hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &res) != 0) return -1;
+    int fd = -1;
+    for (addrinfo *ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && ::connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) { ::close(fd); fd = -1; }
     }
+    freeaddrinfo(res);
+    int one = 1;
+    if (fd >= 0) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    return fd;
+}
 
-    void withdraw(long long cents) {
-        if (cents <= 0) throw invalid_argument("Withdrawal must be positive");
-        if (cents > balanceCents_) throw runtime_error("Insufficient funds");
-        balanceCents_ -= cents;
+// Appends one request frame; body is built by the caller.
+static void wireRequest(string &out, uint32_t tag, WireOp op, const string &body) {
+    uint32_t len = (uint32_t)(5 + body.size());
+    out.append((const char *)&len, 4); out.append((const char *)&tag, 4); out += (char)op; out += body;
+}
+template <class T> static void wirePut(string &body, T v) { body.append((const char *)&v, sizeof v); }
+static void wirePutStr(string &body, const string &s) { body += (char)min<size_t>(s.size(), 255); body.append(s, 0, 255); }
+
+static bool sendAll(int fd, const string &data) {
+    for (size_t sent = 0; sent < data.size();) {
+        ssize_t w = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        sent += (size_t)w;
     }
-};
+    return true;
+}
 
-// ---------------- Bank class ----------------
-class Bank {
-    vector<Account> accounts_;
-    int nextId_ = 1001; // simple incremental IDs
-public:
-    int createAccount(const string &owner, const string &pin) {
-        accounts_.emplace_back(nextId_, owner, pin);
-        return nextId_++;
+static LoadgenResult runLoadgen(const string &host, int port, size_t conns, double seconds, size_t depth) {
+    conns = max<size_t>(conns, 1); depth = max<size_t>(depth, 1);
+    vector<int> ids(conns, 0);
+    vector<LoadgenResult> part(conns);
+    vector<vector<double>> lat(conns);
+    atomic<size_t> ready{0};
+    atomic<bool> go{false};
+    auto client = [&](size_t k) {
+        LoadgenResult &r = part[k];
+        int fd = wireConnect(host, port);
+        string in, out, body;
+        // Setup, one request at a time.
+        auto call = [&](WireOp op, const string &b, int64_t &value) {
+            out.clear(); wireRequest(out, 0, op, b);
+            if (fd < 0 || !sendAll(fd, out)) return (uint8_t)kWireBadRequest;
+            while (in.size() < kWireResponse) {
+                char buf[256]; ssize_t n = ::recv(fd, buf, sizeof buf, 0);
+                if (n <= 0) return (uint8_t)kWireBadRequest;
+                in.append(buf, (size_t)n);
+            }
+            uint8_t st = (uint8_t)in[8]; memcpy(&value, &in[9], 8);
+            in.erase(0, kWireResponse);
+            return st;
+        };
+        int64_t id = 0, token = 0, v;
+        body.clear(); wirePutStr(body, "load" + to_string(k)); wirePutStr(body, "1234");
+        bool ok = call(WireOp::Create, body, id) == 0;
+        body.clear(); wirePut(body, (int32_t)id); wirePutStr(body, "1234");
+        ok = ok && call(WireOp::Login, body, token) == 0;
+        body.clear(); wirePut(body, (int32_t)id); wirePut(body, (uint64_t)token); wirePut(body, (int64_t)1000000);
+        ok = ok && call(WireOp::Deposit, body, v) == 0;
+        if (ok) { ids[k] = (int)id; r.netCents += 1000000; }
+        ++ready;
+        while (!go.load()) this_thread::yield();
+        if (!ok) { r.failed = 1; if (fd >= 0) ::close(fd); return; }
+
+        struct Slot { WireOp op; long long cents; chrono::steady_clock::time_point t0; };
+        vector<Slot> slots(depth);
+        mt19937 rng(31 + (unsigned)k);
+        auto issue = [&](uint32_t s) {
+            unsigned pick = rng() % 10;
+            Slot &sl = slots[s];
+            sl.op = pick < 4 ? WireOp::Deposit : pick < 7 ? WireOp::Withdraw : pick < 9 ? WireOp::Balance : WireOp::Transfer;
+            sl.cents = 1 + (long long)(rng() % 1000);
+            body.clear(); wirePut(body, (int32_t)id); wirePut(body, (uint64_t)token);
+            if (sl.op == WireOp::Transfer) wirePut(body, (int32_t)ids[rng() % conns]);
+            if (sl.op != WireOp::Balance) wirePut(body, (int64_t)sl.cents);
+            wireRequest(out, s, sl.op, body);
+            sl.t0 = chrono::steady_clock::now();
+        };
+        const auto t0 = chrono::steady_clock::now();
+        const auto deadline = t0 + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+        out.clear();
+        for (uint32_t s = 0; s < depth; ++s) issue(s);
+        size_t outstanding = depth;
+        char buf[1 << 16];
+        while (outstanding > 0) {
+            if (!out.empty() && !sendAll(fd, out)) break;
+            out.clear();
+            ssize_t n = ::recv(fd, buf, sizeof buf, 0);
+            if (n <= 0) break;
+            in.append(buf, (size_t)n);
+            size_t pos = 0;
+            auto now = chrono::steady_clock::now();
+            for (; in.size() - pos >= kWireResponse; pos += kWireResponse) {
+                uint32_t tag; memcpy(&tag, &in[pos + 4], 4);
+                uint8_t st = (uint8_t)in[pos + 8];
+                if (tag >= depth) { ++r.failed; continue; }
+                Slot &sl = slots[tag];
+                lat[k].push_back(chrono::duration<double, nano>(now - sl.t0).count());
+                ++r.requests;
+                if (st == kWireAuthFailed || st == kWireBadRequest) ++r.failed;
+                else if (st == (uint8_t)OpStatus::Ok && sl.op == WireOp::Deposit) r.netCents += sl.cents;
+                else if (st == (uint8_t)OpStatus::Ok && sl.op == WireOp::Withdraw) r.netCents -= sl.cents;
+                if (now < deadline) issue(tag); else --outstanding;
+            }
+            in.erase(0, pos);
+        }
+        if (outstanding) r.failed += outstanding;
+        r.secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        ::close(fd);
+    };
+    vector<thread> pool;
+    for (size_t k = 0; k < conns; ++k) pool.emplace_back(client, k);
+    while (ready.load() < conns) this_thread::yield();
+    go = true;
+    for (auto &th : pool) th.join();
+    LoadgenResult total;
+    vector<double> all;
+    for (size_t k = 0; k < conns; ++k) {
+        total.requests += part[k].requests; total.failed += part[k].failed; total.netCents += part[k].netCents;
+        total.secs = max(total.secs, part[k].secs);
+        all.insert(all.end(), lat[k].begin(), lat[k].end());
     }
+    total.p50 = percentileNs(all, 0.50); total.p99 = percentileNs(all, 0.99); total.p999 = percentileNs(all, 0.999);
+    return total;
+}
 
-    Account* findById(int id) {
-        for (auto &a : accounts_) if (a.id() == id) return &a;
-        return nullptr;
+static void printLoadgen(const string &label, const LoadgenResult &r) {
+    cout << left << setw(36) << label << right << setw(12) << fixed << setprecision(0)
+         << (r.secs > 0 ? (double)r.requests / r.secs : 0) << " req/s  p50 " << r.p50 / 1000 << " us  p99 "
+         << r.p99 / 1000 << " us  p99.9 " << r.p999 / 1000 << " us  failed " << r.failed << "\n";
+}
+
+// In-process server on a free port, driven over loopback at pipeline
+// depth 1 (request/response) and 64; checks the bank's total against the
+// deposits and withdrawals the clients saw accepted.
+static void benchServer() {
+    for (size_t depth : {1, 64}) {
+        Bank bank;
+        RequestEngine engine(4);
+        BankServer server(bank, engine);
+        if (!server.listen(0)) { cout << "  server: listen failed\n"; return; }
+        thread loop([&] { server.run(); });
+        LoadgenResult r = runLoadgen("127.0.0.1", server.port(), 4, 1.0, depth);
+        server.stop();
+        loop.join();
+        printLoadgen("server conns=4 pipeline=" + to_string(depth), r);
+        long long total = 0;
+        bank.forEachAccount([&](const Bank::AccountView &v) { total += v.balanceCents; });
+        if (r.failed || total != r.netCents) cout << "  SERVER MISMATCH: total " << total << " vs " << r.netCents << "\n";
     }
+}
 
-    Account* login(int id, const string &pin) {
-        Account* acc = findById(id);
-        if (!acc) return nullptr;
-        if (!acc->verifyPin(pin)) return nullptr;
-        return acc;
+static void benchCheckpoint(size_t n) {
+    const string wal = "bench_ckpt.wal", snap = "bench_ckpt.snap", tsv = "bench_ckpt.tsv";
+    std::remove(wal.c_str()); std::remove((wal + ".ckpt").c_str());
+    Bank bank;
+    for (size_t i = 0; i < n; ++i) bank.createAccount("Owner " + to_string(i % 5000), "1234");
+    bank.attachWal(wal);
+    mt19937 rng(8);
+    uniform_int_distribution<int> pick(1001, 1000 + (int)n);
+    const size_t ops = 200000;
+    auto run = [&](bool checkpoints) {
+        vector<double> lat; lat.reserve(ops);
+        for (size_t i = 0; i < ops; ++i) {
+            if (checkpoints && (i & 255) == 0) {
+                bank.pollCheckpoint();
+                if (!bank.checkpointRunning()) bank.beginCheckpoint(snap, tsv);
+            }
+            auto t0 = chrono::steady_clock::now();
+            bank.deposit(*bank.findById(pick(rng)), 1);
+            lat.push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count());
+        }
+        bank.pollCheckpoint(true);
+        double p50 = percentileNs(lat, 0.50), p99 = percentileNs(lat, 0.99), mx = *max_element(lat.begin(), lat.end());
+        cout << "  deposit latency " << (checkpoints ? "during checkpoints" : "no checkpoint     ")
+             << fixed << setprecision(0) << "  p50 " << p50 << " ns  p99 " << p99 << " ns  max " << mx << " ns\n";
+    };
+    run(false);
+    run(true);
+    const CheckpointStats &st = bank.checkpointStats();
+    cout << "  checkpoints n=" << n << ": " << st.completed << " done, " << st.failed << " failed, last "
+         << setprecision(1) << st.lastDurationMs << " ms (max " << st.maxDurationMs << " ms), fork pause "
+         << st.lastForkPauseUs << " us\n";
+    Bank rec;
+    long long a = 0, b = 0;
+    rec.recover(snap, tsv, wal);
+    for (int id = 1001; id < 1001 + (int)min<size_t>(n, 1000); ++id) {
+        rec.balanceOf(id, a); bank.balanceOf(id, b);
+        if (a != b) { cout << "  CHECKPOINT RECOVERY MISMATCH at " << id << "\n"; break; }
     }
+    for (const string &f : {wal, wal + ".ckpt", snap, tsv}) std::remove(f.c_str());
+}
+
+// Mixed deposit/withdraw/create load from 1..64 threads against one Bank.
+// Ends by checking that no update was lost: the final total must equal the
+// starting total plus every successful deposit minus every withdrawal.
+static void benchConcurrency(size_t n) {
+    n = max<size_t>(n, 64);
+    const size_t totalOps = 2000000;
+    for (int threads : {1, 2, 4, 8, 16, 32, 64}) {
+        Bank bank;
+        for (size_t i = 0; i < n; ++i) bank.deposit(*bank.findById(bank.createAccount("bench", "1234")), 1000000);
+        atomic<long long> net{0};
+        double t = benchSeconds([&] {
+            vector<thread> pool;
+            for (int w = 0; w < threads; ++w) pool.emplace_back([&, w] {
+                mt19937 rng(1234 + w);
+                uniform_int_distribution<int> pick(1001, 1000 + (int)n);
+                long long local = 0;
+                for (size_t i = 0; i < totalOps / threads; ++i) {
+                    unsigned r = rng() % 100;
+                    if (r == 0) { bank.createAccount("new", "1234"); continue; }
+                    Account &a = *bank.findById(pick(rng));
+                    long long c = 1 + (long long)(rng() % 500);
+                    if (r < 70) { bank.deposit(a, c); local += c; }
+                    else { try { bank.withdraw(a, c); local -= c; } catch (const exception &) {} }
+                }
+                net += local;
+            });
+            for (auto &th : pool) th.join();
+        });
+        long long total = 0;
+        bank.forEachAccount([&](const Bank::AccountView &v) { total += v.balanceCents; });
+        benchReport("mt.mixed threads=" + to_string(threads), totalOps / threads * threads, t);
+        if (total != (long long)n * 1000000 + net) cout << "  LOST UPDATE: total " << total << "\n";
+    }
+}
 
-    void listAccounts() const {
-        cout << "\n=== Accounts (for demo) ===\n";
-        for (auto &a : accounts_) {
-            cout << "ID: " << a.id() << ", Owner: " << a.owner() << ", Balance: " << formatCents(a.balanceCents()) << "\n";
+// Locked vs Atomic balance mode: `hot` = every thread on the same 4
+// accounts, otherwise uniform over n. Same lost-update check as above.
+static void benchBalanceModes(size_t n) {
+    n = max<size_t>(n, 64);
+    const size_t totalOps = 2000000;
+    for (bool hot : {true, false}) {
+        for (int threads : {1, 4, 16, 64}) {
+            for (BalanceMode mode : {BalanceMode::Locked, BalanceMode::Atomic}) {
+                Bank bank(mode);
+                for (size_t i = 0; i < n; ++i) bank.deposit(*bank.findById(bank.createAccount("bench", "1234")), 1000000);
+                atomic<long long> net{0};
+                double t = benchSeconds([&] {
+                    vector<thread> pool;
+                    for (int w = 0; w < threads; ++w) pool.emplace_back([&, w] {
+                        mt19937 rng(99 + w);
+                        uniform_int_distribution<int> pick(1001, hot ? 1004 : 1000 + (int)n);
+                        long long local = 0;
+                        for (size_t i = 0; i < totalOps / threads; ++i) {
+                            Account &a = *bank.findById(pick(rng));
+                            long long c = 1 + (long long)(rng() & 255);
+                            if (rng() & 1) { bank.deposit(a, c); local += c; }
+                            else { try { bank.withdraw(a, c); local -= c; } catch (const exception &) {} }
+                        }
+                        net += local;
+                    });
+                    for (auto &th : pool) th.join();
+                });
+                long long total = 0;
+                bank.forEachAccount([&](const Bank::AccountView &v) { total += v.balanceCents; });
+                benchReport(string("mt.") + (hot ? "hot4" : "uniform") + (mode == BalanceMode::Atomic ? "/atomic" : "/locked")
+                            + " threads=" + to_string(threads), totalOps / threads * threads, t);
+                if (total != (long long)n * 1000000 + net) cout << "  LOST UPDATE: total " << total << "\n";
+            }
         }
-        if (accounts_.empty()) cout << "(none)\n";
     }
+}
 
-    bool saveToFile(const std::string& path) const {
-        std::ofstream out(path, std::ios::trunc);
-        if (!out) return false;
-        for (const auto& a: accounts_){
-          string owner = a.owner();
-          replace(owner.begin(), owner.end(), '\t', ' ');
+// Withdrawals at 0/50/100% decline rates through the throwing API and the
+// noexcept try* API, on a bare Account and through Bank.
+static void benchDeclines() {
+    const size_t ops = 200000;
+    for (int pct : {0, 50, 100}) {
+        auto amount = [&](size_t i) { return (long long)(i % 100) < pct ? 1000000000LL : 1LL; };
+        Account acc(1001, "bench", "1234");
+        Bank bank;
+        Account &ba = *bank.findById(bank.createAccount("bench", "1234"));
+        size_t declined[4] = {};
+        double t[4];
+        t[0] = benchSeconds([&] {
+            for (size_t i = 0; i < ops; ++i) {
+                acc.tryDeposit(1);
+                try { acc.withdraw(amount(i)); } catch (const runtime_error &) { ++declined[0]; }
+            }
+        });
+        t[1] = benchSeconds([&] {
+            for (size_t i = 0; i < ops; ++i) { acc.tryDeposit(1); declined[1] += acc.tryWithdraw(amount(i)) != OpStatus::Ok; }
+        });
+        t[2] = benchSeconds([&] {
+            for (size_t i = 0; i < ops; ++i) {
+                bank.deposit(ba, 1);
+                try { bank.withdraw(ba, amount(i)); } catch (const runtime_error &) { ++declined[2]; }
+            }
+        });
+        t[3] = benchSeconds([&] {
+            long long bal;
+            for (size_t i = 0; i < ops; ++i) { bank.tryDeposit(ba, 1, bal); declined[3] += bank.tryWithdraw(ba, amount(i), bal) != OpStatus::Ok; }
+        });
+        const char *names[4] = {"account.withdraw/throw", "account.withdraw/try", "bank.withdraw/throw", "bank.withdraw/try"};
+        for (int k = 0; k < 4; ++k) benchReport(string(names[k]) + " declines=" + to_string(pct) + "%", ops, t[k]);
+        if (declined[0] != declined[1] || declined[2] != declined[3]) cout << "  DECLINE COUNT MISMATCH\n";
+    }
+}
 
+// applyBatch vs the same ops through deposit/withdraw/transfer one by one,
+// without and with a WAL (Group sync). Checks statuses and balances match
+// the loop and that WAL replay of the Batch records reproduces them.
+static void benchBatch(size_t n) {
+    n = max<size_t>(n, 16);
+    const string wal = "bench_accounts.wal", snap = "bench_accounts.snap", tsv = "bench_accounts.tsv";
+    const size_t kBatch = 4096, kRounds = 100;
+    mt19937 rng(77);
+    uniform_int_distribution<int> pick(1001, 1000 + (int)n + 2); // a few misses
+    vector<BatchOp> ops(kBatch);
+    for (bool logged : {false, true}) {
+        vector<long long> balances[2];
+        vector<OpStatus> statuses[2];
+        for (int batched = 0; batched < 2; ++batched) {
+            std::remove(wal.c_str());
+            Bank bank;
+            for (size_t i = 0; i < n; ++i) bank.deposit(*bank.findById(bank.createAccount("bench", "1234")), 10000);
+            if (logged && !bank.attachWal(wal, {WalOptions::Sync::Group, 64, 5})) { cout << "wal open failed\n"; return; }
+            rng.seed(77);
+            double t = 0;
+            for (size_t r = 0; r < kRounds; ++r) {
+                for (auto &o : ops) {
+                    o = {(BatchOp::Kind)(rng() % 3), pick(rng), (long long)(rng() % 3000) - 10, pick(rng)};
+                }
+                t += benchSeconds([&] {
+                    if (batched) { vector<OpStatus> st = bank.applyBatch(ops); statuses[1].insert(statuses[1].end(), st.begin(), st.end()); return; }
+                    for (const BatchOp &o : ops) {
+                        Account *a = bank.findById(o.id), *b = bank.findById(o.toId);
+                        OpStatus st = OpStatus::Ok;
+                        try {
+                            if (!a || (o.kind == BatchOp::Kind::Transfer && !b)) st = OpStatus::NoSuchAccount;
+                            else if (o.kind == BatchOp::Kind::Deposit) bank.deposit(*a, o.cents);
+                            else if (o.kind == BatchOp::Kind::Withdraw) bank.withdraw(*a, o.cents);
+                            else if (a == b) st = OpStatus::SameAccount;
+                            else bank.transfer(*a, *b, o.cents);
+                        } catch (const invalid_argument &) { st = OpStatus::InvalidAmount; }
+                        catch (const runtime_error &) { st = OpStatus::InsufficientFunds; }
+                        statuses[0].push_back(st);
+                    }
+                });
+            }
+            if (logged) t += benchSeconds([&] { bank.syncWal(); });
+            benchReport(string(batched ? "applyBatch" : "op-loop") + (logged ? "/wal-group" : "/no-wal") + " batch=" + to_string(kBatch),
+                        kBatch * kRounds, t);
+            bank.forEachAccount([&](const Bank::AccountView &v) { balances[batched].push_back(v.balanceCents); });
+            if (!logged || !batched) continue;
+            Bank rec;
+            for (size_t i = 0; i < n; ++i) rec.deposit(*rec.findById(rec.createAccount("bench", "1234")), 10000);
+            rec.recover(snap, tsv, wal);
+            vector<long long> got;
+            rec.forEachAccount([&](const Bank::AccountView &v) { got.push_back(v.balanceCents); });
+            if (got != balances[1]) cout << "  BATCH WAL REPLAY MISMATCH\n";
+        }
+        if (balances[0] != balances[1] || statuses[0] != statuses[1]) cout << "  BATCH RESULT MISMATCH vs op loop\n";
+    }
+    std::remove(wal.c_str());
+}
 
+// Random transfers from 1..64 threads (single calls vs transferMany), in
+// both balance modes. Money is only moved, so the total must not change.
+static void benchTransfers(size_t n) {
+    n = max<size_t>(n, 64);
+    const size_t totalOps = 1000000;
+    for (BalanceMode mode : {BalanceMode::Locked, BalanceMode::Atomic}) {
+        for (bool batched : {false, true}) {
+            for (int threads : {1, 4, 16, 64}) {
+                Bank bank(mode);
+                for (size_t i = 0; i < n; ++i) bank.deposit(*bank.findById(bank.createAccount("bench", "1234")), 100000);
+                double t = benchSeconds([&] {
+                    vector<thread> pool;
+                    for (int w = 0; w < threads; ++w) pool.emplace_back([&, w] {
+                        mt19937 rng(500 + w);
+                        uniform_int_distribution<int> pick(1001, 1000 + (int)n);
+                        size_t ops = totalOps / threads;
+                        if (batched) {
+                            vector<TransferRequest> batch(1000);
+                            for (size_t done = 0; done < ops; done += batch.size()) {
+                                for (auto &r : batch) { r.from = pick(rng); r.to = pick(rng); r.cents = 1 + (long long)(rng() & 1023); }
+                                bank.transferMany(batch);
+                            }
+                            return;
+                        }
+                        for (size_t i = 0; i < ops; ++i) {
+                            int a = pick(rng), b = pick(rng);
+                            if (a == b) continue;
+                            try { bank.transfer(*bank.findById(a), *bank.findById(b), 1 + (long long)(rng() & 1023)); } catch (const exception &) {}
+                        }
+                    });
+                    for (auto &th : pool) th.join();
+                });
+                long long total = 0;
+                bank.forEachAccount([&](const Bank::AccountView &v) { total += v.balanceCents; });
+                benchReport(string(batched ? "transferMany" : "transfer") + (mode == BalanceMode::Atomic ? "/atomic" : "/locked")
+                            + " threads=" + to_string(threads), totalOps / threads * threads, t);
+                if (total != (long long)n * 100000) cout << "  MONEY NOT CONSERVED: total " << total << "\n";
+            }
+        }
+    }
+}
 
+// One Bank vs a ShardedBank (one shard per thread) on a uniform mix of
+// deposits, withdrawals and transfers; most transfers cross shards. Then
+// crash recovery of cross-shard transfers when one shard's log is lost.
+static void benchSharding(size_t n) {
+    n = max<size_t>(n, 256);
+    const size_t totalOps = 2000000;
+    for (int threads : {1, 4, 16, 64}) {
+        for (bool sharded : {false, true}) {
+            Bank single;
+            ShardedBank multi((size_t)threads);
+            vector<int> ids(n);
+            for (size_t i = 0; i < n; ++i) {
+                ids[i] = sharded ? multi.createAccount("bench", "1234") : single.createAccount("bench", "1234");
+                Account &a = *(sharded ? multi.findById(ids[i]) : single.findById(ids[i]));
+                sharded ? multi.deposit(a, 100000) : single.deposit(a, 100000);
+            }
+            atomic<long long> net{0};
+            double t = benchSeconds([&] {
+                vector<thread> pool;
+                for (int w = 0; w < threads; ++w) pool.emplace_back([&, w] {
+                    mt19937 rng(700 + w);
+                    long long local = 0, bal;
+                    for (size_t i = 0; i < totalOps / threads; ++i) {
+                        int x = ids[rng() % n], y = ids[rng() % n];
+                        Account &a = *(sharded ? multi.findById(x) : single.findById(x));
+                        long long c = 1 + (long long)(rng() & 1023);
+                        unsigned r = rng() % 4;
+                        if (r == 0) { if ((sharded ? multi.tryDeposit(a, c, bal) : single.tryDeposit(a, c, bal)) == OpStatus::Ok) local += c; }
+                        else if (r == 1) {
+                            OpStatus st = sharded ? multi.tryWithdraw(a, c, bal) : single.tryWithdraw(a, c, bal);
+                            if (st == OpStatus::Ok) local -= c;
+                        } else if (x != y) {
+                            Account &b = *(sharded ? multi.findById(y) : single.findById(y));
+                            sharded ? multi.tryTransfer(a, b, c, bal) : single.tryTransfer(a, b, c, bal);
+                        }
+                    }
+                    net += local;
+                });
+                for (auto &th : pool) th.join();
+            });
+            long long total = 0;
+            auto add = [&](const Bank::AccountView &v) { total += v.balanceCents; };
+            if (sharded) multi.forEachAccount(add); else single.forEachAccount(add);
+            benchReport(string(sharded ? "sharded" : "single") + " threads=" + to_string(threads), totalOps / threads * threads, t);
+            if (total != (long long)n * 100000 + net) cout << "  MONEY NOT CONSERVED: total " << total << "\n";
         }
+    }
+
+    // Checkpoint, then cross-shard transfers between shards 0 and 1 only;
+    // "lose" shard 1's whole log and recover. Every transfer left exactly
+    // one half behind, so recovery must re-apply the other and land on the
+    // pre-crash balances exactly, and again after a second restart.
+    const string wal = "bench_shard.wal", snap = "bench_shard.snap", tsv = "bench_shard.tsv";
+    auto cleanup = [&] {
+        for (size_t k = 0; k < 4; ++k)
+            for (const string &f : {wal, wal + ".ckpt", snap, tsv}) std::remove((f + "." + to_string(k)).c_str());
     };
-    bool loadFromFile(const std::string& path) {
-        ifstream in(path);
-        if (!in) return false;
-        
-        accounts_.clear();
-        int maxId = 1000;
-        string line;
-        while (getline(in, line)) {
+    cleanup();
+    vector<int> ids;
+    unordered_map<int, long long> expect;
+    {
+        ShardedBank bank(4);
+        bank.recover(snap, tsv, wal);
+        bank.attachWal(wal, {WalOptions::Sync::None, 64, 5});
+        while (ids.size() < 64) {
+            int id = bank.createAccount("bench", "1234");
+            if (bank.shardOf(id) < 2) { ids.push_back(id); bank.deposit(*bank.findById(id), 100000); }
+        }
+        bank.checkpoint(snap, tsv);
+        mt19937 rng(4242);
+        for (int i = 0; i < 20000; ++i) {
+            int x = ids[rng() % ids.size()], y = ids[rng() % ids.size()];
+            if (bank.shardOf(x) == bank.shardOf(y)) continue;
+            long long bal;
+            bank.tryTransfer(*bank.findById(x), *bank.findById(y), 1 + (long long)(rng() & 4095), bal);
+        }
+        bank.syncWal();
+        for (int id : ids) bank.balanceOf(id, expect[id]);
+    }
+    { ofstream lost(wal + ".1", ios::binary | ios::trunc); lost << "BANKWAL1"; }
+    size_t repaired = 0;
+    bool match = true;
+    for (int pass = 0; pass < 2; ++pass) {
+        ShardedBank bank(4);
+        bank.recover(snap, tsv, wal);
+        if (pass == 0) repaired = bank.recoveredRepairs();
+        else if (bank.recoveredRepairs() != 0) match = false; // the first restart logged its repairs
+        bank.attachWal(wal, {WalOptions::Sync::None, 64, 5});
+        for (int id : ids) { long long c = 0; bank.balanceOf(id, c); match = match && c == expect[id]; }
+    }
+    if (!match) cout << "  SHARDED RECOVERY MISMATCH\n";
+    else cout << "  sharded recovery: " << repaired << " lost transfer halves re-applied, balances match\n";
+    cleanup();
 
+    // A cross-shard credit refused at the limit is refunded at the source,
+    // and the refund pairs the halves: recovery repairs nothing.
+    int src = 0, dst = 0;
+    {
+        ShardedBank bank(2);
+        bank.recover(snap, tsv, wal);
+        bank.attachWal(wal, {WalOptions::Sync::None, 64, 5});
+        while (!src || !dst) {
+            int id = bank.createAccount("bench", "1234");
+            (bank.shardOf(id) == 0 ? src : dst) = id;
         }
-        nextId_ = maxId + 1;
-        return true;
+        long long bal;
+        bank.deposit(*bank.findById(src), 100);
+        bank.deposit(*bank.findById(dst), kMaxBalanceCents - 5);
+        match = bank.tryTransfer(*bank.findById(src), *bank.findById(dst), 50, bal) == OpStatus::BalanceLimit;
+        match &= bank.tryTransfer(*bank.findById(src), *bank.findById(dst), 5, bal) == OpStatus::Ok;
+        bank.syncWal();
+    }
+    {
+        ShardedBank bank(2);
+        bank.recover(snap, tsv, wal);
+        long long a = 0, b = 0;
+        bank.balanceOf(src, a); bank.balanceOf(dst, b);
+        match &= bank.recoveredRepairs() == 0 && a == 95 && b == kMaxBalanceCents;
+    }
+    if (!match) cout << "  SHARDED REFUND MISMATCH\n";
+    for (size_t k = 0; k < 2; ++k)
+        for (const string &f : {wal, wal + ".ckpt", snap, tsv}) std::remove((f + "." + to_string(k)).c_str());
+}
+
+// Request engine: 4 client threads issuing uniform deposits directly vs
+// posting them to the engine keyed by account (affinity) or round-robin;
+// then a submit().get() round trip as the CLI does, and stealing when
+// every request is keyed to one worker.
+static void benchEngine(size_t n) {
+    n = max<size_t>(n, 256);
+    const size_t totalOps = 1000000, clients = 4, workers = 4;
+    for (int how = 0; how < 3; ++how) {
+        Bank bank;
+        for (size_t i = 0; i < n; ++i) bank.createAccount("bench", "1234");
+        RequestEngine engine(workers);
+        double t = benchSeconds([&] {
+            vector<thread> pool;
+            for (size_t c = 0; c < clients; ++c) pool.emplace_back([&, c] {
+                mt19937 rng(900 + (unsigned)c);
+                for (size_t i = 0; i < totalOps / clients; ++i) {
+                    int id = 1001 + (int)(rng() % n);
+                    auto op = [&bank, id] { long long bal; bank.tryDeposit(*bank.findById(id), 1, bal); };
+                    if (how == 0) op();
+                    else if (how == 1) engine.post(id, op);
+                    else engine.post(op);
+                }
+            });
+            for (auto &th : pool) th.join();
+            engine.wait();
+        });
+        long long total = 0;
+        bank.forEachAccount([&](const Bank::AccountView &v) { total += v.balanceCents; });
+        benchReport(string(how == 0 ? "deposit/direct" : how == 1 ? "engine.post/affinity" : "engine.post/round-robin")
+                    + " clients=" + to_string(clients), totalOps / clients * clients, t);
+        if (total != (long long)(totalOps / clients * clients)) cout << "  ENGINE LOST REQUESTS: total " << total << "\n";
+    }
+    Bank bank;
+    int id = bank.createAccount("bench", "1234");
+    Account &a = *bank.findById(id);
+    RequestEngine engine(workers);
+    const size_t trips = 100000;
+    double t = benchSeconds([&] { for (size_t i = 0; i < trips; ++i) g_benchSink += engine.submit(id, [&] { return bank.deposit(a, 1); }).get(); });
+    benchReport("engine.submit+get round trip", trips, t);
+    size_t declined = 0;
+    try { engine.submit(id, [&] { return bank.withdraw(a, LLONG_MAX); }).get(); } catch (const runtime_error &) { ++declined; }
+    const size_t hot = 200000;
+    const uint64_t stolenBefore = engine.steals();
+    for (size_t i = 0; i < hot; ++i) engine.post(id, [&] { long long bal; bank.tryDeposit(a, 1, bal); for (volatile int k = 0; k < 50; ++k) {} });
+    engine.wait();
+    if (a.balanceCents() != (long long)(trips + hot) || !declined) cout << "  ENGINE MISMATCH\n";
+    else cout << "  engine: one hot account, " << engine.steals() - stolenBefore << " of " << hot << " tasks stolen by idle workers\n";
+}
+
+// Script mode on a generated replay (creates, then a deposit/withdraw/
+// transfer/balance mix with some bad lines): throughput, and the same
+// script run twice on fresh banks must give byte-identical output.
+static void benchScript(size_t n) {
+    n = max<size_t>(min<size_t>(n, 100000), 64);
+    const size_t ops = 1000000;
+    string text;
+    for (size_t i = 0; i < n; ++i) text += "NEW 1234 Owner " + to_string(i) + "\n";
+    mt19937 rng(77);
+    char line[96];
+    for (size_t i = 0; i < ops; ++i) {
+        int a = 1001 + (int)(rng() % n), b = 1001 + (int)(rng() % n);
+        unsigned r = rng() % 100, c = rng() % 100000;
+        if (r < 40) snprintf(line, sizeof line, "DEP %d %u.%02u\n", a, c / 100, c % 100);
+        else if (r < 70) snprintf(line, sizeof line, "WD %d %u.%02u\n", a, c / 100, c % 100);
+        else if (r < 90) snprintf(line, sizeof line, "XFER %d %d %u\n", a, b, c % 500);
+        else if (r < 99) snprintf(line, sizeof line, "BAL %d\n", a);
+        else snprintf(line, sizeof line, "DEP %d twelve\n", a);
+        text += line;
+    }
+    string outputs[2];
+    ScriptStats st;
+    for (int pass = 0; pass < 2; ++pass) {
+        Bank bank;
+        istringstream in(text);
+        ostringstream os;
+        {
+            TextSink sink(os, 1 << 20);
+            st = runScript(bank, in, sink);
+        }
+        outputs[pass] = os.str();
+    }
+    benchReport("script replay ops=" + to_string(st.ops), st.ops, st.secs);
+    cout << "  script: " << st.errors << " errors (" << st.byKind[ScriptStats::kParseError] << " malformed, "
+         << st.byKind[(size_t)OpStatus::InsufficientFunds] << " insufficient funds)\n";
+    if (outputs[0] != outputs[1] || st.ops != n + ops || st.byKind[ScriptStats::kParseError] == 0) cout << "  SCRIPT REPLAY MISMATCH\n";
+}
+
+// Reporting scans alongside transfers: a row-by-row total (forEachAccount)
+// vs a ReadView total, and the transfer rate under each. Transfers conserve
+// money, so every view total must equal the seeded total exactly, and a
+// by-balance listing paged from one view must show every account once.
+static void benchReadViews(size_t n) {
+    n = min<size_t>(max<size_t>(n, 100000), 1000000);
+    vector<Bank::NewAccount> batch(n, {"bench", "1234"});
+    bool ok = true;
+    for (BalanceMode mode : {BalanceMode::Locked, BalanceMode::Atomic}) {
+        Bank bank(mode);
+        bank.createAccounts(batch.data(), n);
+        long long seeded = 0, bal;
+        for (size_t i = 0; i < n; ++i) { long long c = 1000 + (long long)((i * 7919) % 100000); bank.tryDeposit(*bank.findById(1001 + (int)i), c, bal); seeded += c; }
+        const string tag = mode == BalanceMode::Atomic ? "/atomic" : "/locked";
+        for (int reporter = 0; reporter < 3; ++reporter) {
+            atomic<bool> done{false};
+            atomic<size_t> transfers{0};
+            vector<thread> writers;
+            for (int w = 0; w < 2; ++w)
+                writers.emplace_back([&, w] {
+                    mt19937 rng(17 + w);
+                    size_t mine = 0;
+                    long long b;
+                    while (!done.load(memory_order_relaxed)) {
+                        Account &from = *bank.findById(1001 + (int)(rng() % n)), &to = *bank.findById(1001 + (int)(rng() % n));
+                        if (&from != &to && bank.tryTransfer(from, to, 1 + (long long)(rng() % 500), b) == OpStatus::Ok) ++mine;
+                    }
+                    transfers += mine;
+                });
+            // One report every 10 ms, so the rates compare interference, not CPU share.
+            size_t scans = 0, off = 0;
+            double scanSecs = 0, openSecs = 0, openMax = 0;
+            auto t0 = chrono::steady_clock::now();
+            while (chrono::steady_clock::now() - t0 < chrono::milliseconds(400)) {
+                this_thread::sleep_for(chrono::milliseconds(10));
+                if (reporter == 0) continue;
+                long long total = 0;
+                auto s0 = chrono::steady_clock::now();
+                if (reporter == 1) bank.forEachAccount([&](const Bank::AccountView &v) { total += v.balanceCents; });
+                else {
+                    Bank::ReadView v = bank.readView();
+                    double o = chrono::duration<double>(chrono::steady_clock::now() - s0).count();
+                    openSecs += o; openMax = max(openMax, o);
+                    total = v.totalCents();
+                }
+                scanSecs += chrono::duration<double>(chrono::steady_clock::now() - s0).count();
+                ++scans; off += total != seeded;
+            }
+            done = true;
+            for (thread &w : writers) w.join();
+            double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+            static const char *kName[] = {"none", "rows", "view"};
+            benchReport("views.transfer" + tag + " reporter=" + kName[reporter], transfers, secs);
+            if (reporter) cout << "  " << scans << " total scans (" << fixed << setprecision(2) << scanSecs * 1e3 / max<size_t>(scans, 1)
+                               << " ms each), " << off << " off the conserved total\n" << defaultfloat;
+            if (reporter == 2) {
+                cout << "  view open under load: " << fixed << setprecision(1) << openSecs * 1e6 / max<size_t>(scans, 1) << " us avg, "
+                     << openMax * 1e6 << " us max" << (mode == BalanceMode::Atomic ? " (writers paused for the gate drain)\n" : " (writers not paused)\n") << defaultfloat;
+                ok &= off == 0;
+            }
+        }
+
+        // View open cost, and a scan of it.
+        const int reps = 200;
+        double t = benchSeconds([&] { for (int r = 0; r < reps; ++r) { Bank::ReadView v = bank.readView(); long long c = 0; v.balanceOf(1001, c); g_benchSink += c; } });
+        benchReport("views.open" + tag, reps, t);
+        {
+            Bank::ReadView v = bank.readView();
+            t = benchSeconds([&] { g_benchSink += v.totalCents(); });
+            benchReport("views.total" + tag + " n=" + to_string(n), n, t);
+        }
+
+        // By-balance pages from one view while money moves: each account once.
+        atomic<bool> done{false};
+        thread writer([&] {
+            mt19937 rng(5);
+            long long b;
+            while (!done.load(memory_order_relaxed)) bank.tryTransfer(*bank.findById(1001 + (int)(rng() % n)), *bank.findById(1001 + (int)(rng() % n)), 1 + (long long)(rng() % 50000), b);
+        });
+        vector<char> seen(n, 0);
+        size_t rows = 0;
+        {
+            Bank::ReadView view = bank.readView();
+            const long long pinned = view.totalCents();
+            ostringstream discard;
+            TextSink sink(discard, SIZE_MAX);
+            for (ListCursor c; !c.done;) {
+                c = bank.listAccounts(view, c, 4096, ListOrder::ByBalance, sink);
+                string &page = sink.buffer();
+                for (size_t at = 0; (at = page.find("ID: ", at)) != string::npos; at += 4) {
+                    int id = 0;
+                    from_chars(page.data() + at + 4, page.data() + page.size(), id);
+                    if (id >= 1001 && (size_t)(id - 1001) < n && !seen[id - 1001]) { seen[id - 1001] = 1; ++rows; }
+                }
+                page.clear();
+            }
+            ok &= rows == n && pinned == seeded && view.totalCents() == pinned;
+        }
+        done = true;
+        writer.join();
+    }
+    if (!ok) cout << "  VIEW MISMATCH\n";
+}
+
+// Nightly accrual: per-account deposit/withdraw calls (one WAL record
+// each) against Bank::accrue (one record per chunk, parallel chunks).
+// Checks that both give the same cents, that the log replays to the same
+// balances, and that money is conserved with deposits running alongside.
+static void benchAccrual(size_t n) {
+    n = min<size_t>(max<size_t>(n, 200000), 1000000);
+    const string wal = "bench_accrual.wal", snap = "bench_accrual.snap", tsv = "bench_accrual.tsv";
+    const AccrualRule rule{137, -25, 1000}; // 0.00137% interest, 25c fee, on balances >= $10
+    vector<Bank::NewAccount> batch(n, {"bench", "1234"});
+    auto seed = [&](Bank &bank) {
+        bank.createAccounts(batch.data(), n);
+        for (size_t i = 0; i < n; ++i) bank.deposit(*bank.findById(1001 + (int)i), 1 + (long long)((i * 7919) % 10000000));
+    };
+    auto same = [&](const Bank &a, const Bank &b) {
+        bool eq = true;
+        for (size_t i = 0; i < n; i += 97) { long long x = 0, y = 1; a.balanceOf(1001 + (int)i, x); b.balanceOf(1001 + (int)i, y); eq &= x == y; }
+        return eq;
+    };
+    auto walBytes = [&] { struct stat st; return ::stat(wal.c_str(), &st) == 0 ? (size_t)st.st_size : 0; };
+    const WalOptions opt{WalOptions::Sync::None, 64, 5};
+
+    Bank perAccount;
+    seed(perAccount);
+    std::remove(wal.c_str());
+    perAccount.attachWal(wal, opt);
+    double t = benchSeconds([&] {
+        for (size_t i = 0; i < n; ++i) {
+            Account &a = *perAccount.findById(1001 + (int)i);
+            long long next, bal; bool capped;
+            if (!accrualNext(rule, a.balanceCents(), next, capped)) continue;
+            if (next > a.balanceCents()) perAccount.tryDeposit(a, next - a.balanceCents(), bal);
+            else perAccount.tryWithdraw(a, a.balanceCents() - next, bal);
+        }
+        perAccount.syncWal();
+    });
+    benchReport("accrual/per-account n=" + to_string(n), n, t);
+    cout << "  per-account: " << walBytes() / 1024 << " KB of WAL\n";
+
+    bool ok = true;
+    for (unsigned threads : {1u, 4u}) {
+        for (BalanceMode mode : {BalanceMode::Locked, BalanceMode::Atomic}) {
+            if (threads == 1 && mode == BalanceMode::Atomic) continue;
+            Bank bank(mode);
+            seed(bank);
+            std::remove(wal.c_str());
+            bank.attachWal(wal, opt);
+            AccrualResult r;
+            t = benchSeconds([&] { r = bank.accrue(rule, threads); bank.syncWal(); });
+            benchReport(string("accrual/accrue") + (mode == BalanceMode::Atomic ? "/atomic" : "") + " threads=" + to_string(threads), n, t);
+            cout << "  " << r.accounts << " changed in " << r.chunks << " chunks, " << r.capped << " capped, "
+                 << walBytes() / 1024 << " KB of WAL\n";
+            ok &= same(bank, perAccount);
+        }
+    }
+    // The last log (4 threads, atomic) replays onto the seeded balances.
+    Bank replayed;
+    seed(replayed);
+    replayed.recover(snap, tsv, wal);
+    ok &= same(replayed, perAccount);
+    std::remove(wal.c_str());
+
+    // Deposits during the pass: every cent is accounted for.
+    Bank live;
+    seed(live);
+    long long before = 0, after = 0, deposited = 0;
+    live.forEachAccount([&](const Bank::AccountView &v) { before += v.balanceCents; });
+    atomic<bool> done{false};
+    thread depositor([&] {
+        mt19937 rng(3);
+        long long bal;
+        while (!done.load(memory_order_relaxed))
+            if (live.tryDeposit(*live.findById(1001 + (int)(rng() % n)), 1, bal) == OpStatus::Ok) ++deposited;
+    });
+    AccrualResult r = live.accrue(rule, 4);
+    done = true;
+    depositor.join();
+    live.forEachAccount([&](const Bank::AccountView &v) { after += v.balanceCents; });
+    ok &= after == before + deposited + r.creditedCents - r.debitedCents;
+    if (!ok) cout << "  ACCRUAL MISMATCH\n";
+}
+
+// Cost of recording history on the deposit path, "last N" and date-range
+// queries, a check that a wrapped ring still returns each account's
+// newest entries, in order, while appends run on other threads, and one
+// that racing Atomic-mode appends keep date ranges complete.
+static void benchHistory(size_t n) {
+    n = max<size_t>(min<size_t>(n, 100000), 64);
+    const size_t ops = 1000000;
+    mt19937 rng(13);
+    vector<int> ids(ops);
+    for (auto &id : ids) id = 1001 + (int)(rng() % n);
+    auto deposits = [&](Bank &bank) {
+        return benchSeconds([&] { long long bal = 0; for (int id : ids) bank.tryDeposit(*bank.findById(id), 1, bal); g_benchSink += bal; });
+    };
+    vector<Bank::NewAccount> batch(n, {"bench", "1234"});
+    Bank plain, recorded;
+    plain.createAccounts(batch.data(), n);
+    recorded.createAccounts(batch.data(), n);
+    recorded.enableHistory(ops);
+    benchReport("deposit/history-off", ops, deposits(plain));
+    benchReport("deposit/history-on", ops, deposits(recorded));
+    const TransactionHistory &h = *recorded.history();
+    cout << "  history: " << h.appended() << " entries, " << TransactionHistory::kNodeBytes << " B each, "
+         << h.bytes() / (1 << 20) << " MB allocated\n";
+
+    const size_t queries = 200000;
+    vector<HistoryEntry> rows;
+    double t = benchSeconds([&] {
+        for (size_t q = 0; q < queries; ++q) { rows.clear(); recorded.lastTransactions(ids[q], 10, rows); g_benchSink += (long long)rows.size(); }
+    });
+    benchReport("history.last10", queries, t);
+    const int64_t now = unixMicros();
+    t = benchSeconds([&] {
+        for (size_t q = 0; q < queries; ++q) { rows.clear(); recorded.transactionsBetween(ids[q], now - 60000000, now, rows, 10); g_benchSink += (long long)rows.size(); }
+    });
+    benchReport("history.range(1min,10)", queries, t);
+
+    // Ring of two segments (the minimum), lapped several times by 4 writer
+    // threads while a reader checks that every chain is newest-first.
+    Bank small;
+    small.createAccounts(batch.data(), n);
+    small.enableHistory(1);
+    const size_t writers = 4, perWriter = 200000;
+    atomic<bool> done{false};
+    atomic<size_t> badOrder{0};
+    thread reader([&] {
+        vector<HistoryEntry> r;
+        for (size_t q = 0; !done.load(memory_order_relaxed); ++q) {
+            r.clear();
+            small.lastTransactions(1001 + (int)(q % n), 64, r);
+            for (size_t i = 1; i < r.size(); ++i) if (r[i].timeUs > r[i - 1].timeUs) ++badOrder;
+        }
+    });
+    vector<thread> pool;
+    for (size_t w = 0; w < writers; ++w)
+        pool.emplace_back([&, w] {
+            long long bal = 0;
+            for (size_t i = 0; i < perWriter; ++i) small.tryDeposit(*small.findById(1001 + (int)((w * perWriter + i) % n)), 1, bal);
+        });
+    for (auto &th : pool) th.join();
+    done = true;
+    reader.join();
+    size_t kept = 0;
+    for (size_t i = 0; i < n; ++i) { rows.clear(); kept += small.lastTransactions(1001 + (int)i, SIZE_MAX, rows); }
+    cout << "  ring: " << small.history()->appended() << " appended, " << kept << " kept (capacity " << small.history()->capacity() << ")\n";
+    if (badOrder || kept == 0 || kept > small.history()->capacity() || small.history()->appended() != writers * perWriter)
+        cout << "  HISTORY RING MISMATCH\n";
+
+    // Atomic mode: appends to the same few accounts race (so a chain may be
+    // slightly out of time order), yet a date range returns every entry in it.
+    Bank hot(BalanceMode::Atomic);
+    hot.createAccounts(batch.data(), 4);
+    hot.enableHistory(writers * perWriter);
+    pool.clear();
+    for (size_t w = 0; w < writers; ++w)
+        pool.emplace_back([&, w] {
+            long long bal = 0;
+            for (size_t i = 0; i < perWriter; ++i) hot.tryDeposit(*hot.findById(1001 + (int)((w + i) % 4)), 1, bal);
+        });
+    for (auto &th : pool) th.join();
+    bool rangeOk = true;
+    for (int id = 1001; id < 1005; ++id) {
+        rows.clear();
+        size_t all = hot.lastTransactions(id, SIZE_MAX, rows);
+        rangeOk &= all == writers * perWriter / 4;
+        if (rows.empty()) continue;
+        int64_t from = rows[rows.size() * 3 / 4].timeUs, to = rows[rows.size() / 4].timeUs;
+        if (from > to) swap(from, to);
+        size_t want = 0;
+        for (const HistoryEntry &e : rows) want += e.timeUs >= from && e.timeUs <= to;
+        vector<HistoryEntry> got;
+        rangeOk &= hot.transactionsBetween(id, from, to, got) == want;
+    }
+    if (!rangeOk) cout << "  HISTORY RANGE MISMATCH\n";
+}
+
+// Cost of the latency probes on the hottest path, and a check that the
+// merged counts add up across threads (including ones that have exited).
+static void benchStats(size_t n) {
+    n = max<size_t>(min<size_t>(n, 100000), 64);
+    Bank bank;
+    vector<Bank::NewAccount> batch(n, {"bench", "1234"});
+    bank.createAccounts(batch.data(), n);
+    const size_t ops = 2000000;
+    mt19937 rng(9);
+    vector<int> ids(ops);
+    for (auto &id : ids) id = 1001 + (int)(rng() % n);
+    auto run = [&] {
+        long long bal = 0;
+        for (int id : ids) bank.tryDeposit(*bank.findById(id), 1, bal);
+        g_benchSink += bal;
     };
+    statsReset();
+    g_statsEnabled = false;
+    benchReport("deposit/stats-off", ops, benchSeconds(run));
+    g_statsEnabled = BANK_STATS;
+    benchReport("deposit/stats-on", ops, benchSeconds(run));
+
+    const size_t threads = 4, perThread = 50000;
+    vector<thread> pool;
+    for (size_t t = 0; t < threads; ++t)
+        pool.emplace_back([&, t] {
+            long long bal = 0;
+            for (size_t i = 0; i < perThread; ++i) {
+                Account &a = *bank.findById(1001 + (int)((t * perThread + i) % n));
+                bank.tryWithdraw(a, i % 2 ? 1 : LLONG_MAX / 4, bal); // every other one declines
+            }
+        });
+    for (auto &th : pool) th.join();
+    bank.login(1001, "0000");
+    StatsSnapshot s;
+    double t = benchSeconds([&] { s = statsSnapshot(); });
+    cout << "  stats merge " << fixed << setprecision(3) << t * 1e3 << " ms; deposit p50 " << s.percentile(StatOp::Deposit, 0.5)
+         << " ns  p99 " << s.percentile(StatOp::Deposit, 0.99) << " ns  max " << s.maxNs[(size_t)StatOp::Deposit] << " ns\n";
+    g_statsEnabled = false;
+    if (BANK_STATS && (s.count[(size_t)StatOp::Deposit] != ops || s.count[(size_t)StatOp::Withdraw] != threads * perThread ||
+                       s.counters[(size_t)StatCounter::InsufficientFunds] != threads * perThread / 2 ||
+                       s.counters[(size_t)StatCounter::BadPin] != 1))
+        cout << "  STATS COUNT MISMATCH\n";
+    statsReset();
+}
+
+// createAccounts, findById, login and deposit/withdraw at 1K, 1M and 10M
+// accounts, so lookups that stop fitting in cache show up.
+static void benchScale() {
+    for (size_t n : {size_t(1000), size_t(1000000), size_t(10000000)}) {
+        const string at = " n=" + to_string(n);
+        Bank bank;
+        vector<Bank::NewAccount> batch(min<size_t>(n, 1000000), {"bench", "1234"});
+        double t = benchSeconds([&] {
+            for (size_t done = 0; done < n; done += batch.size()) bank.createAccounts(batch.data(), min(batch.size(), n - done));
+        });
+        benchReport("scale.createAccounts" + at, n, t);
+        const size_t ops = 2000000;
+        mt19937 rng(5);
+        vector<int> ids(ops);
+        for (auto &id : ids) id = 1001 + (int)(rng() % n);
+        t = benchSeconds([&] { long long s = 0; for (int id : ids) s += bank.findById(id)->id(); g_benchSink += s; });
+        benchReport("scale.findById" + at, ops, t);
+        t = benchSeconds([&] { long long s = 0; for (size_t i = 0; i < ops / 20; ++i) s += bank.login(ids[i], "1234") != nullptr; g_benchSink += s; });
+        benchReport("scale.login" + at, ops / 20, t);
+        t = benchSeconds([&] {
+            long long bal, s = 0;
+            for (size_t i = 0; i < ops; ++i) {
+                Account &a = *bank.findById(ids[i]);
+                s += (int)((i & 1) ? bank.tryWithdraw(a, 1, bal) : bank.tryDeposit(a, 1, bal));
+            }
+            g_benchSink += s;
+        });
+        benchReport("scale.deposit+withdraw" + at, ops, t);
+    }
+}
+
+// PIN KDF cost per level, login (KDF) vs session resume (cache) latency,
+// plus the cache's eviction/expiry/PIN-change rules and the legacy-hash
+// upgrade on login. Runs at the default cost; the benches after it lower
+// g_pinCost so they measure the bank rather than the KDF.
+static void benchPins() {
+    for (unsigned cost : {0u, 8u, 10u, 12u, 14u}) {
+        size_t ops = cost == 0 ? 100000 : max<size_t>(4, 4096 >> (cost > 10 ? cost - 10 : 0) >> 2);
+        double t = benchSeconds([&] { size_t x = 0; for (size_t i = 0; i < ops; ++i) x ^= hashPin("123456", i, cost); g_benchSink += (long long)(x & 1); });
+        benchReport(cost ? "hashPin/pbkdf2-sha256 cost=" + to_string(cost) + " (" + to_string(1u << cost) + " iters)" : string("hashPin/legacy-std::hash"), ops, t);
+    }
+    Bank bank;
+    int id = bank.createAccount("bench", "1234");
+    vector<double> loginNs, resumeNs;
+    uint64_t token = 0;
+    for (int i = 0; i < 50; ++i) {
+        auto t0 = chrono::steady_clock::now();
+        token = bank.openSession(id, "1234");
+        loginNs.push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count());
+    }
+    for (int i = 0; i < 100000; ++i) {
+        auto t0 = chrono::steady_clock::now();
+        g_benchSink += bank.resume(id, token) != nullptr;
+        resumeNs.push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count());
+    }
+    cout << "  login(kdf cost " << g_pinCost.load() << ")  p50 " << (long long)percentileNs(loginNs, 0.5) << " ns  p99 " << (long long)percentileNs(loginNs, 0.99) << " ns\n"
+         << "  resume(session)     p50 " << (long long)percentileNs(resumeNs, 0.5) << " ns  p99 " << (long long)percentileNs(resumeNs, 0.99) << " ns\n";
+
+    bool ok = bank.resume(id, token) && !bank.resume(id, token + 1) && !bank.resume(id + 1, token) && !bank.openSession(id, "9999");
+    bank.setPin(*bank.findById(id), "5678");
+    ok = ok && !bank.resume(id, token);                       // PIN change ends sessions
+    bank.configureSessions(2, chrono::milliseconds(50));
+    uint64_t a = bank.openSession(id, "5678"), b = bank.openSession(id, "5678"), c = bank.openSession(id, "5678");
+    ok = ok && !bank.resume(id, a) && bank.resume(id, b) && bank.resume(id, c); // capacity 2: oldest evicted
+    this_thread::sleep_for(chrono::milliseconds(60));
+    ok = ok && !bank.resume(id, c);                           // expired
+    const string tsv = "bench_legacy.tsv";
+    { ofstream(tsv) << "1001\tlegacy\t0\t42\t" << hashPin("1234", 42, 0) << "\n"; }
+    Bank old;
+    old.loadFromFile(tsv);
+    std::remove(tsv.c_str());
+    ok = ok && old.findById(1001)->pinCost() == 0 && old.login(1001, "1234") && old.findById(1001)->pinCost() == g_pinCost
+         && old.login(1001, "1234") && !old.login(1001, "1235");
+    cout << (ok ? "  sessions: expiry, eviction, PIN-change and legacy upgrade OK\n" : "  SESSION/PIN CHECK FAILED\n");
+}
+
+// Owner names for the benches: 100k distinct "First Last N" names of
+// 8-30 bytes, so some fit std::string's SSO buffer and some don't.
+static string benchOwnerName(size_t i) {
+    static const char *firsts[] = {"Ann", "Bob", "Carla", "Dmitri", "Eve", "Francesca", "Gus", "Hiroshi", "Ines", "Jo"};
+    static const char *lasts[] = {"Li", "Smith", "Okafor", "Nakamura", "Rodriguez-Vega", "Schwarzenegger", "Kowalski", "Ng"};
+    size_t k = i % 100000;
+    return string(firsts[k % 10]) + " " + lasts[(k / 10) % 8] + " " + to_string(k / 80);
+}
+
+// Owner index on >= 1M accounts: exact and prefix queries vs a full scan
+// (results must match), incremental maintenance during createAccounts,
+// bulk rebuild in loadFromFile and the lazy build after a snapshot open.
+static void benchOwners(size_t n) {
+    n = max<size_t>(n, 1000000);
+    const string tsv = "bench_owners.tsv", snap = "bench_owners.snap";
+    vector<Bank::NewAccount> batch(n);
+    for (size_t i = 0; i < n; ++i) batch[i] = {benchOwnerName(i), "1234"};
+    Bank bank;
+    double t = benchSeconds([&] { bank.createAccounts(batch); });
+    benchReport("createAccounts+owner-index n=" + to_string(n), n, t);
+
+    const vector<string> keys = {"Eve Smith 12", "Gus Ng", "Francesca Rodriguez-Vega 1", "Jo", "Nobody"};
+    bool ok = true;
+    for (const string &k : keys) {
+        vector<int> scan;
+        bank.forEachAccount([&](const Bank::AccountView &v) { if (v.owner.substr(0, k.size()) == k) scan.push_back(v.id); });
+        vector<OwnerMatch> got = bank.searchOwnerPrefix(k, SIZE_MAX);
+        vector<int> ids;
+        for (const OwnerMatch &m : got) ids.push_back(m.id);
+        sort(ids.begin(), ids.end());
+        ok = ok && ids == scan;
+    }
+    const size_t q = 20000;
+    t = benchSeconds([&] { for (size_t i = 0; i < q; ++i) g_benchSink += (long long)bank.findByOwner(benchOwnerName(i * 7919)).size(); });
+    benchReport("findByOwner/index n=" + to_string(n), q, t);
+    t = benchSeconds([&] { for (size_t i = 0; i < q; ++i) g_benchSink += (long long)bank.searchOwnerPrefix(benchOwnerName(i * 7919).substr(0, 8), 20).size(); });
+    benchReport("searchOwnerPrefix/index limit=20", q, t);
+    t = benchSeconds([&] {
+        size_t hits = 0;
+        bank.forEachAccount([&](const Bank::AccountView &v) { hits += v.owner.substr(0, 8) == "Eve Smit"; });
+        g_benchSink += (long long)hits;
+    });
+    benchReport("searchOwnerPrefix/full-scan", 1, t);
+
+    bank.saveToFile(tsv);
+    bank.saveSnapshot(snap);
+    Bank loaded;
+    t = benchSeconds([&] { loaded.loadFromFile(tsv); });
+    cout << "  loadFromFile incl. owner index build: " << fixed << setprecision(1) << t * 1000 << " ms\n";
+    Bank mapped;
+    mapped.openSnapshot(snap);
+    t = benchSeconds([&] { ok = ok && mapped.findByOwner("Eve Smith 12").size() == bank.findByOwner("Eve Smith 12").size(); });
+    cout << "  first query after snapshot open (lazy build): " << t * 1000 << " ms\n";
+    cout.unsetf(ios::floatfield);
+    ok = ok && loaded.findByOwner("Gus Ng 3").size() == bank.findByOwner("Gus Ng 3").size() && !bank.findByOwner("Gus Ng 3").empty();
+    if (!ok) cout << "  OWNER INDEX MISMATCH vs full scan\n";
+    std::remove(tsv.c_str()); std::remove(snap.c_str());
+}
+
+// Paged listing vs the old one-pass listing (formatCents + cout per row)
+// and vs a full sort by balance. Paging through everything must visit
+// each account once, in order.
+static void benchListing(size_t n) {
+    n = max<size_t>(n, 100000);
+    Bank bank;
+    vector<Bank::NewAccount> batch(n, {"bench", "1234"});
+    vector<int> ids = bank.createAccounts(batch);
+    mt19937 rng(9);
+    for (int id : ids) bank.deposit(*bank.findById(id), 1 + (long long)(rng() % 1000000));
+    ofstream devnull("/dev/null");
+    double t = benchSeconds([&] {
+        bank.forEachAccount([&](const Bank::AccountView &a) {
+            devnull << "ID: " << a.id << ", Owner: " << a.owner << ", Balance: " << formatCents(a.balanceCents) << "\n";
+        });
+        devnull.flush();
+    });
+    benchReport("listAccounts/legacy-full n=" + to_string(n), 1, t);
+    TextSink sink(devnull);
+    for (ListOrder order : {ListOrder::ById, ListOrder::ByBalance}) {
+        const char *name = order == ListOrder::ById ? "byId" : "byBalance";
+        t = benchSeconds([&] { bank.listAccounts(ListCursor{}, 20, order, sink); sink.flush(); });
+        benchReport(string("listAccounts/page20/") + name, 1, t);
+        size_t rows = 0; bool ordered = true;
+        ostringstream all;
+        TextSink collect(all, 1 << 20);
+        t = benchSeconds([&] {
+            for (ListCursor c; !c.done;) {
+                ListCursor next = bank.listAccounts(c, 1000, order, collect);
+                bool moved = next.id != c.id || next.balance != c.balance;
+                if (moved && c.id != INT_MIN && (order == ListOrder::ById ? next.id <= c.id : next.balance > c.balance)) ordered = false;
+                c = next;
+            }
+            collect.flush();
+        });
+        for (char ch : all.str()) rows += ch == '\n';
+        benchReport(string("listAccounts/all-pages1000/") + name, 1, t);
+        if (rows != n || !ordered) cout << "  LISTING MISMATCH (" << rows << " rows)\n";
+    }
+    t = benchSeconds([&] {
+        vector<pair<long long, int>> v;
+        bank.forEachAccount([&](const Bank::AccountView &a) { v.push_back({-a.balanceCents, a.id}); });
+        sort(v.begin(), v.end());
+        g_benchSink += v[0].second;
+    });
+    benchReport("byBalance/full-sort", 1, t);
+}
+
+// Memory per account, old row layout (std::string owner) vs interned
+// owner IDs. Each layout is built in its own forked child so one's heap
+// can't hide in the other's RSS; owners are drawn from 100k distinct
+// "First Last" names, some within the SSO limit, some not.
+// ./bank --footprint [N] runs just this (default N = 10M).
+struct LegacyAccountRow {
+    int id; string owner; atomic<long long> balanceCents; size_t salt, pinHash; uint8_t pinCost;
+    LegacyAccountRow(int i, string o, long long b) : id(i), owner(std::move(o)), balanceCents(b), salt(0), pinHash(0), pinCost(0) {}
 };
 
-// ---------------- CLI helpers ----------------
-static string prompt(const string &msg) { cout << msg; cout.flush(); string s; getline(cin, s); return s; }
-static int promptInt(const string &msg) { while (true) { cout << msg; cout.flush(); string s; getline(cin, s); try { return stoi(s); } catch (...) { cout << "Invalid number. Try again.\n"; } } }
+static size_t residentBytes() {
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    unsigned long pages = 0, rss = 0;
+    int got = fscanf(f, "%lu %lu", &pages, &rss);
+    fclose(f);
+    return got == 2 ? (size_t)rss * (size_t)sysconf(_SC_PAGESIZE) : 0;
+}
 
-static long long promptAmountCents(const string &msg) { while (true) { string s = prompt(msg); try { return parseAmountCents(s); } catch (const exception &e) { cout << "Invalid amount: " << e.what() << ". Try again.\n"; } } }
+static void benchFootprint(size_t n) {
+    auto name = benchOwnerName;
+    cout << "  sizeof: legacy row " << sizeof(LegacyAccountRow) << " B, Account " << sizeof(Account) << " B\n";
+    for (int layout = 0; layout < 2; ++layout) {
+        int fds[2];
+        if (pipe(fds) != 0) return;
+        pid_t pid = fork();
+        if (pid < 0) { ::close(fds[0]); ::close(fds[1]); return; }
+        if (pid == 0) {
+            ::close(fds[0]);
+            size_t before = residentBytes(), names = 0;
+            auto t0 = chrono::steady_clock::now();
+            if (layout == 0) {
+                auto *rows = new ChunkedArena<LegacyAccountRow>;
+                for (size_t i = 0; i < n; ++i) rows->emplace_back(1001 + (int)i, name(i), 0LL);
+            } else {
+                auto *rows = new ChunkedArena<Account>;
+                for (size_t i = 0; i < n; ++i) rows->emplace_back(1001 + (int)i, ownerNames().intern(name(i)), 0LL, 0, 0, 0u);
+                names = ownerNames().bytes();
+            }
+            double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+            double out[3] = {(double)(residentBytes() - before), (double)names, secs};
+            ssize_t w = ::write(fds[1], out, sizeof out);
+            _exit(w == (ssize_t)sizeof out ? 0 : 1);
+        }
+        ::close(fds[1]);
+        double in[3] = {};
+        bool got = ::read(fds[0], in, sizeof in) == (ssize_t)sizeof in;
+        ::close(fds[0]);
+        waitpid(pid, nullptr, 0);
+        if (!got) { cout << "  footprint child failed\n"; continue; }
+        cout << "  footprint/" << (layout ? "interned" : "std::string") << " n=" << n << ": "
+             << fixed << setprecision(1) << in[0] / (double)n << " B/account RSS (" << in[0] / 1048576.0 << " MB)";
+        if (layout) cout << ", owner table " << in[1] / 1048576.0 << " MB";
+        cout << ", built in " << setprecision(2) << in[2] << " s\n";
+        cout.unsetf(ios::floatfield);
+    }
+}
+
+static int runBenchmarks(int argc, char **argv) {
+    size_t n = 100000;
+    string json, filter;
+    for (int i = 2; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc) json = argv[++i];
+        else if (arg == "--filter" && i + 1 < argc) filter = argv[++i];
+        else n = (size_t)stoull(arg);
+    }
+    if (!json.empty()) {
+        g_benchJson.open(json, ios::trunc);
+        if (!g_benchJson) { cerr << "Cannot write " << json << "\n"; return 1; }
+        g_benchJson << "{\"meta\":true,\"n\":" << n << ",\"kernels\":"
+                    << jsonQuote(balanceKernels().name) << ",\"cpus\":" << thread::hardware_concurrency()
+                    << ",\"unix_time\":" << chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count() << "}\n";
+    }
+    // Everything after "pins" runs at KDF cost 1, so it measures the bank rather than the KDF.
+    const pair<const char *, function<void()>> groups[] = {
+        {"pins", [] { benchPins(); }},
+        {"lookup", [&] { benchLookup(n); }},
+        {"onboarding", [&] { benchOnboarding(n); }},
+        {"footprint", [&] { benchFootprint(n); }},
+        {"owners", [&] { benchOwners(n); }},
+        {"listing", [&] { benchListing(n); }},
+        {"columnar", [&] { benchColumnar(n); }},
+        {"kernels", [&] { benchKernels(n); }},
+        {"parser", [] { benchParser(); }},
+        {"format", [] { benchFormat(); }},
+        {"money", [] { benchMoney(); }},
+        {"persistence", [&] { benchPersistence(n); }},
+        {"snapshot", [&] { benchSnapshot(n); }},
+        {"wal", [] { benchWal(); }},
+        {"checkpoint", [&] { benchCheckpoint(n); }},
+        {"concurrency", [&] { benchConcurrency(n); }},
+        {"balance-modes", [&] { benchBalanceModes(n); }},
+        {"transfers", [&] { benchTransfers(n); }},
+        {"sharding", [&] { benchSharding(n); }},
+        {"engine", [&] { benchEngine(n); }},
+        {"server", [] { benchServer(); }},
+        {"script", [&] { benchScript(n); }},
+        {"batch", [&] { benchBatch(n); }},
+        {"accrual", [&] { benchAccrual(n); }},
+        {"views", [&] { benchReadViews(n); }},
+        {"declines", [] { benchDeclines(); }},
+        {"history", [&] { benchHistory(n); }},
+        {"stats", [&] { benchStats(n); }},
+        {"scale", [] { benchScale(); }},
+    };
+    cout << "=== Benchmarks (N=" << n << ") ===\n";
+    for (auto &[name, run] : groups) {
+        if (filter.empty() || string(name).find(filter) != string::npos) { g_benchGroup = name; run(); }
+        g_pinCost = 1;
+    }
+    return 0;
+}
 
 // ---------------- Main menu ----------------
-static void accountSession(Account* acc) {
+// Each action re-authenticates through the session cache, not the PIN KDF.
+// The menu is one client of the request engine: it does the terminal I/O
+// and waits for each request's result before showing the next prompt.
+static void accountSession(Bank &bank, RequestEngine &engine, int id, uint64_t token) {
     while (true) {
-        cout << "\n[Account " << acc->id() << "] Options:\n"
+        cout << "\n[Account " << id << "] Options:\n"
              << " 1) Check balance\n"
              << " 2) Deposit\n"
              << " 3) Withdraw\n"
-             << " 4) Logout\n";
+             << " 4) Transfer\n"
+             << " 5) Statement\n"
+             << " 6) Logout\n";
         int ch = promptInt("Choose: ");
+        engine.submit([&] { bank.maybeCheckpoint(); }).get();
+        Account *acc = engine.submit(id, [&] { return bank.resume(id, token); }).get();
+        if (!acc) { cout << "Session expired. Please log in again.\n"; break; }
         try {
             if (ch == 1) {
-                cout << "Balance: " << formatCents(acc->balanceCents()) << "\n";
+                long long bal = engine.submit(id, [&] { return bank.balanceCents(*acc); }).get();
+                cout << "Balance: " << centsText(bal) << "\n";
             } else if (ch == 2) {
                 long long cents = promptAmountCents("Amount to deposit (e.g., 100 or 12.34): ");
-                acc->deposit(cents);
-                cout << "Deposited. New balance: " << formatCents(acc->balanceCents()) << "\n";
+                long long bal = engine.submit(id, [&] { return bank.deposit(*acc, cents); }).get();
+                cout << "Deposited. New balance: " << centsText(bal) << "\n";
             } else if (ch == 3) {
                 long long cents = promptAmountCents("Amount to withdraw: ");
-                acc->withdraw(cents);
-                cout << "Withdrawn. New balance: " << formatCents(acc->balanceCents()) << "\n";
+                long long bal = engine.submit(id, [&] { return bank.withdraw(*acc, cents); }).get();
+                cout << "Withdrawn. New balance: " << centsText(bal) << "\n";
             } else if (ch == 4) {
+                int to = promptInt("Destination account ID: ");
+                Account *dest = engine.submit(to, [&] { return bank.findById(to); }).get();
+                if (!dest) { cout << "No such account.\n"; continue; }
+                long long cents = promptAmountCents("Amount to transfer: ");
+                long long left = engine.submit(id, [&] { return bank.transfer(*acc, *dest, cents); }).get();
+                cout << "Transferred. New balance: " << centsText(left) << "\n";
+            } else if (ch == 5) {
+                string what = prompt("Entries to show (Enter for 10), or a date range YYYY-MM-DD YYYY-MM-DD: ");
+                vector<HistoryEntry> rows;
+                char from[16], to[16];
+                int64_t fromUs, toUs;
+                if (sscanf(what.c_str(), "%15s %15s", from, to) == 2) {
+                    if (!parseLocalDate(from, fromUs) || !parseLocalDate(to, toUs)) { cout << "Invalid date.\n"; continue; }
+                    toUs += 86400LL * 1000000 - 1; // through the end of the last day
+                    engine.submit(id, [&] { return bank.transactionsBetween(id, fromUs, toUs, rows); }).get();
+                } else {
+                    size_t n = what.empty() ? 10 : (size_t)max(0, atoi(what.c_str()));
+                    engine.submit(id, [&] { return bank.lastTransactions(id, n, rows); }).get();
+                }
+                if (!bank.history()) cout << "(history is off: BANK_HISTORY=0)\n"; else printStatement(rows);
+            } else if (ch == 6) {
+                engine.submit(id, [&] { bank.closeSession(token); }).get();
                 cout << "Logging out...\n"; break;
             } else {
                 cout << "Invalid option.\n";
@@ -196,12 +5872,67 @@ static void accountSession(Account* acc) {
     }
 }
 
-int main() {
+int main(int argc, char **argv) {
     ios::sync_with_stdio(false); cin.tie(nullptr);
-    Bank bank;
-    const string DB = "accounts.tsv";
-    bank.loadFromFile(DB);
-
+    if (argc > 1 && string(argv[1]) == "--bench") return runBenchmarks(argc, argv);
+    if (argc > 3 && string(argv[1]) == "--bench-compare") return compareBenchmarks(argv[2], argv[3], argc > 4 ? atof(argv[4]) : 10.0);
+    if (argc > 1 && string(argv[1]) == "--footprint") { benchFootprint(argc > 2 ? (size_t)stoull(argv[2]) : 10000000); return 0; }
+    if (argc > 1 && string(argv[1]) == "--loadgen") {
+        string target = argc > 2 ? argv[2] : "7070", host = "127.0.0.1";
+        if (size_t colon = target.rfind(':'); colon != string::npos) { host = target.substr(0, colon); target = target.substr(colon + 1); }
+        LoadgenResult r = runLoadgen(host, atoi(target.c_str()), argc > 3 ? (size_t)atoi(argv[3]) : 4,
+                                     argc > 4 ? atof(argv[4]) : 5.0, argc > 5 ? (size_t)atoi(argv[5]) : 32);
+        printLoadgen("loadgen " + host + ":" + target, r);
+        return r.requests ? 0 : 1;
+    }
+    // --serve stops on SIGINT/SIGTERM through a signalfd; block them before
+    // any thread (WAL flusher, engine) starts so every thread inherits the mask.
+    const bool serve = argc > 1 && string(argv[1]) == "--serve";
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals); sigaddset(&stopSignals, SIGINT); sigaddset(&stopSignals, SIGTERM);
+    if (serve) pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+    if (const char *c = getenv("BANK_PIN_COST")) g_pinCost = (unsigned)max(1, min(atoi(c), (int)kMaxPinCost));
+    const char *statsEnv = getenv("BANK_STATS");
+    g_statsEnabled = BANK_STATS && !(statsEnv && (string(statsEnv) == "0" || string(statsEnv) == "off"));
+    const bool script = argc > 1 && string(argv[1]) == "--script";
+    string scriptPath = "-";
+    bool scriptMemory = false;
+    for (int i = 2; script && i < argc; ++i) { if (string(argv[i]) == "--memory") scriptMemory = true; else scriptPath = argv[i]; }
+    if (script && scriptMemory) { Bank scratch; return scriptMode(scratch, scriptPath); }
+    const char *balMode = getenv("BANK_BALANCE_MODE");
+    Bank bank(balMode && string(balMode) == "atomic" ? BalanceMode::Atomic : BalanceMode::Locked);
+    const char *histEnv = getenv("BANK_HISTORY");
+    if (size_t keep = histEnv ? (size_t)strtoull(histEnv, nullptr, 10) : size_t(1) << 20) bank.enableHistory(keep);
+    const string DB = "accounts.tsv", SNAP = "accounts.snap", WAL = "accounts.wal";
+    if (!bank.recover(SNAP, DB, WAL)) cout << "Warning: " << WAL << " is not a write-ahead log; ignoring it.\n";
+    WalOptions walOpt;
+    if (const char *m = getenv("BANK_WAL_SYNC")) {
+        string mode = m;
+        walOpt.sync = mode == "none" ? WalOptions::Sync::None : mode == "always" ? WalOptions::Sync::Always : WalOptions::Sync::Group;
+    }
+    if (!bank.attachWal(WAL, walOpt)) cout << "Warning: cannot open " << WAL << "; changes persist only on exit.\n";
+    bank.enableAutoCheckpoint(SNAP, DB, 10000);
+    if (script) {
+        int rc = scriptMode(bank, scriptPath);
+        if (!bank.checkpoint(SNAP, DB)) { cerr << "Warning: save failed; " << WAL << " kept for recovery.\n"; rc = 1; }
+        return rc;
+    }
+    size_t workers = thread::hardware_concurrency();
+    if (const char *w = getenv("BANK_WORKERS")) workers = (size_t)max(1, atoi(w));
+    RequestEngine engine(max<size_t>(workers, 1));
+    if (serve) {
+        BankServer server(bank, engine);
+        int port = argc > 2 ? atoi(argv[2]) : 7070;
+        int sfd = signalfd(-1, &stopSignals, SFD_CLOEXEC);
+        if (sfd < 0 || !server.listen(port)) { cout << "Cannot listen on port " << port << "\n"; return 1; }
+        cout << "Serving on port " << server.port() << " with " << engine.workers() << " workers (Ctrl-C to stop)\n";
+        cout.flush();
+        server.run(sfd);
+        ::close(sfd);
+        bool ok = bank.checkpoint(SNAP, DB);
+        cout << server.requests() << " requests served" << (ok ? ".\n" : "; save failed, " + WAL + " kept for recovery.\n");
+        return ok ? 0 : 1;
+    }
 
     cout << "=== Bank Account Simulator ===\n";
     while (true) {
@@ -209,13 +5940,16 @@ int main() {
              << " 1) Create account\n"
              << " 2) Login\n"
              << " 3) List accounts (demo)\n"
-             << " 4) Exit\n";
+             << " 4) Search accounts by owner\n"
+             << " 5) Statistics\n"
+             << " 6) Exit\n";
         int choice = promptInt("Choose: ");
+        engine.submit([&] { bank.maybeCheckpoint(); }).get();
         if (choice == 1) {
             string name = prompt("Owner name: ");
             string pin = prompt("Choose PIN (4-12 digits): ");
             try {
-                int id = bank.createAccount(name, pin);
+                int id = engine.submit([&] { return bank.createAccount(name, pin); }).get();
                 cout << "Account created! Your ID is: " << id << "\n";
             } catch (const exception &e) {
                 cout << "Failed to create account: " << e.what() << "\n";
@@ -223,13 +5957,35 @@ int main() {
         } else if (choice == 2) {
             int id = promptInt("Account ID: ");
             string pin = prompt("PIN: ");
-            Account* acc = bank.login(id, pin);
-            if (!acc) { cout << "Login failed. Check ID/PIN.\n"; continue; }
-            accountSession(acc);
+            uint64_t token = engine.submit(id, [&] { return bank.openSession(id, pin); }).get();
+            if (!token) { cout << "Login failed. Check ID/PIN.\n"; continue; }
+            accountSession(bank, engine, id, token);
         } else if (choice == 3) {
-            bank.listAccounts();
+            int ord = promptInt("Order: 1) by ID  2) by balance: ");
+            ListOrder order = ord == 2 ? ListOrder::ByBalance : ListOrder::ById;
+            cout << "\n=== Accounts (for demo) ===\n";
+            if (bank.size() == 0) { cout << "(none)\n"; continue; }
+            TextSink sink(cout);
+            for (ListCursor c; !c.done;) {
+                c = engine.submit([&] { return bank.listAccounts(c, 20, order, sink); }).get();
+                sink.flush();
+                if (!c.done && prompt("-- Enter for more, q to stop: ") == "q") break;
+            }
         } else if (choice == 4) {
-            bank.saveToFile(DB);
+            string prefix = prompt("Owner name or prefix: ");
+            const size_t kShow = 20;
+            vector<OwnerMatch> hits = engine.submit([&] { return bank.searchOwnerPrefix(prefix, kShow + 1); }).get();
+            for (size_t i = 0; i < hits.size() && i < kShow; ++i) cout << "ID: " << hits[i].id << ", Owner: " << hits[i].owner << "\n";
+            if (hits.empty()) cout << "(no matches)\n";
+            else if (hits.size() > kShow) cout << "(more than " << kShow << " matches; refine the prefix)\n";
+        } else if (choice == 5) {
+            if (!g_statsEnabled.load()) { cout << "Statistics are off (BANK_STATS=0).\n"; continue; }
+            string out;
+            formatStatsTable(statsSnapshot(), out);
+            cout << "\n" << out;
+            if (prompt("p for Prometheus text, Enter to return: ") == "p") { out.clear(); formatPrometheus(statsSnapshot(), out); cout << out; }
+        } else if (choice == 6) {
+            if (!engine.submit([&] { return bank.checkpoint(SNAP, DB); }).get()) cout << "Warning: save failed; " << WAL << " kept for recovery.\n";
             cout << "Goodbye!\n"; break;
         } else {
             cout << "Invalid choice.\n";